@@ -3,9 +3,142 @@
  *      Author: Romain Perier <romain.perier@labri.fr>
  */
 
+#include <string.h>
+
 #include "history.h"
 #include "reasoning_debug.h"
 
+#if SENSOR_HISTORY_RUNS
+
+#define run_value(run) (((run) & SENSOR_HISTORY_RUN_VALUE) ? 1 : 0)
+#define run_length(run) ((run) & SENSOR_HISTORY_RUN_LENGTH)
+
+static inline uint16_t history_prev(uint16_t run)
+{
+	return (run + SENSOR_HISTORY_RUN_COUNT - 1) % SENSOR_HISTORY_RUN_COUNT;
+}
+
+/* Append @count times @value, extending the newest run while it can hold them */
+static void history_append(history_t *h, uint8_t value, uint16_t count)
+{
+	uint16_t last = history_prev(h->end), length;
+	uint16_t flag = value ? SENSOR_HISTORY_RUN_VALUE : 0;
+
+	if (h->start != h->end && (h->history[last] & SENSOR_HISTORY_RUN_VALUE) == flag)
+	{
+		length = SENSOR_HISTORY_RUN_LENGTH - run_length(h->history[last]);
+		if (length > count)
+			length = count;
+		h->history[last] += length;
+		count -= length;
+	}
+	while (count)
+	{
+		length = (count > SENSOR_HISTORY_RUN_LENGTH) ? SENSOR_HISTORY_RUN_LENGTH : count;
+		h->history[h->end] = flag | length;
+		h->end = (h->end + 1) % SENSOR_HISTORY_RUN_COUNT;
+		if (h->end == h->start)
+			h->start = (h->start + 1) % SENSOR_HISTORY_RUN_COUNT;
+		count -= length;
+	}
+}
+
+/* Count the values set among the @count most recent ones, from the newest run */
+static uint32_t history_count_ones(history_t *h, uint32_t count)
+{
+	uint16_t run = h->end, length;
+	uint32_t ones = 0;
+
+	while (count && run != h->start)
+	{
+		run = history_prev(run);
+		length = run_length(h->history[run]);
+		if (length > count)
+			length = count;
+		if (run_value(h->history[run]))
+			ones += length;
+		count -= length;
+	}
+	return ones;
+}
+
+uint8_t sensor_history_value(history_t *h, uint16_t pos)
+{
+	uint16_t run = h->end;
+
+	DEBUG("APP", LOG_DEBUG, "%s: pos=%u, start=%u, end=%u\n", __func__, pos, h->start, h->end);
+
+	while (run != h->start)
+	{
+		run = history_prev(run);
+		if (pos < run_length(h->history[run]))
+			return run_value(h->history[run]);
+		pos -= run_length(h->history[run]);
+	}
+	return 0;
+}
+
+uint8_t sensor_history_add(history_t *h, uint8_t value)
+{
+	DEBUG("APP", LOG_DEBUG, "%s: add value=%u to start = %u, end=%u\n", __func__, value, h->start, h->end);
+
+	value &= 1;
+	history_append(h, value, 1);
+	return value;
+}
+
+uint16_t sensor_history_add_sample(history_t *h, uint16_t value, uint8_t width)
+{
+	uint16_t mask = (width >= 16) ? 0xffff : (1 << width) - 1;
+	uint8_t i;
+
+	DEBUG("APP", LOG_DEBUG, "%s: add sample=%x (width=%u) to start = %u, end=%u\n", __func__, value, width, h->start, h->end);
+
+	value &= mask;
+	for (i = 0; i < width; i++)
+		history_append(h, (value >> i) & 0x1, 1);
+	return value;
+}
+
+void sensor_history_add_run(history_t *h, uint8_t value, uint16_t count)
+{
+	DEBUG("APP", LOG_DEBUG, "%s: add value=%u %u times to start = %u, end=%u\n", __func__, value, count, h->start, h->end);
+
+	history_append(h, value & 1, count);
+}
+
+uint32_t sensor_history_last_bits(history_t *h, uint8_t count)
+{
+	uint16_t run = h->end, length;
+	uint8_t pos = 0;
+	uint32_t value = 0;
+
+	// pos 0 is bit count - 1, the newest run fills the lowest bits
+	while (pos < count && run != h->start)
+	{
+		run = history_prev(run);
+		length = run_length(h->history[run]);
+		if (length > count - pos)
+			length = count - pos;
+		if (run_value(h->history[run]))
+			value |= (uint32_t) (((uint64_t) 1 << length) - 1) << (count - pos - length);
+		pos += length;
+	}
+	return value;
+}
+
+uint16_t sensor_history_count_ones(history_t *h, uint16_t count)
+{
+	return history_count_ones(h, count);
+}
+
+uint32_t sensor_history_count_ones_within(history_t *h, uint32_t duration, uint16_t period)
+{
+	return history_count_ones(h, duration / (period ? period : 1));
+}
+
+#else
+
 uint8_t sensor_history_value(history_t *h, uint16_t pos)
 {
 	uint16_t index_byte = 0, index_bit = 0;
@@ -50,3 +183,143 @@ uint8_t sensor_history_add(history_t *h, uint8_t value)
 		h->start = (h->start + 1) % (SENSOR_HISTORY_SIZE * 8);
 	return value;
 }
+
+#define HISTORY_BITS (SENSOR_HISTORY_SIZE * 8)
+
+uint16_t sensor_history_add_sample(history_t *h, uint16_t value, uint8_t width)
+{
+	uint16_t index_byte = h->end / 8;
+	uint16_t index_bit = h->end % 8;
+	uint16_t used = (h->end + HISTORY_BITS - h->start) % HISTORY_BITS;
+	uint16_t mask = (width >= 16) ? 0xffff : (1 << width) - 1;
+
+	DEBUG("APP", LOG_DEBUG, "%s: add sample=%x (width=%u) to start = %u, end=%u, index_byte=%u, index_bit=%u\n", __func__, value, width, h->start, h->end, index_byte, index_bit);
+
+	value &= mask;
+
+	// Samples are aligned on their width, so they never straddle a byte boundary
+	if (width > 8)
+	{
+		h->history[index_byte] = value & 0xff;
+		h->history[index_byte + 1] = value >> 8;
+	}
+	else
+	{
+		h->history[index_byte] &= ~(mask << index_bit);
+		h->history[index_byte] |= (value << index_bit);
+	}
+
+	h->end = (h->end + width) % HISTORY_BITS;
+	if (used + width >= HISTORY_BITS)
+		h->start = (h->end + 1) % HISTORY_BITS;
+	return value;
+}
+
+static inline void history_append_bit(history_t *h, uint8_t value)
+{
+	h->history[h->end / 8] &= ~(1 << (h->end % 8));
+	h->history[h->end / 8] |= value << (h->end % 8);
+	h->end = (h->end + 1) % HISTORY_BITS;
+}
+
+void sensor_history_add_run(history_t *h, uint8_t value, uint16_t count)
+{
+	uint16_t used = (h->end + HISTORY_BITS - h->start) % HISTORY_BITS;
+	uint8_t fill = value ? 0xff : 0;
+
+	DEBUG("APP", LOG_DEBUG, "%s: add value=%u %u times to start = %u, end=%u\n", __func__, value, count, h->start, h->end);
+
+	if (count >= HISTORY_BITS)
+	{
+		memset(h->history, fill, SENSOR_HISTORY_SIZE);
+		h->start = (h->end + 1) % HISTORY_BITS;
+		return;
+	}
+	if (used + count >= HISTORY_BITS)
+		used = HISTORY_BITS;
+
+	for (; count && (h->end % 8 || count < 8); count--)
+	{
+		history_append_bit(h, fill & 1);
+	}
+	for (; count >= 8; count -= 8)
+	{
+		h->history[h->end / 8] = fill;
+		h->end = (h->end + 8) % HISTORY_BITS;
+	}
+	for (; count; count--)
+	{
+		history_append_bit(h, fill & 1);
+	}
+
+	if (used == HISTORY_BITS)
+		h->start = (h->end + 1) % HISTORY_BITS;
+}
+
+uint32_t sensor_history_last_bits(history_t *h, uint8_t count)
+{
+	uint16_t bit = (h->end + HISTORY_BITS - count) % HISTORY_BITS;
+	uint8_t shift = 0, offset, take;
+	uint32_t value = 0;
+
+	while (shift < count)
+	{
+		offset = bit % 8;
+		take = 8 - offset;
+		if (take > count - shift)
+			take = count - shift;
+		value |= (uint32_t)((h->history[bit / 8] >> offset) & ((1 << take) - 1)) << shift;
+		shift += take;
+		bit = (bit + take) % HISTORY_BITS;
+	}
+	return value;
+}
+
+/* Count the bits set in [from; to[, with from <= to <= HISTORY_BITS */
+static uint16_t history_count_ones(const uint8_t *history, uint16_t from, uint16_t to)
+{
+	uint16_t count = 0, byte = from / 8, last = to / 8;
+
+	if (from == to)
+		return 0;
+	if (byte == last)
+		return __builtin_popcount(history[byte] & ((1 << (to % 8)) - 1) & (0xff << (from % 8)));
+
+	count = __builtin_popcount(history[byte] & (0xff << (from % 8)));
+	for (byte++; byte < last; byte++)
+		count += __builtin_popcount(history[byte]);
+	if (to % 8)
+		count += __builtin_popcount(history[last] & ((1 << (to % 8)) - 1));
+	return count;
+}
+
+uint16_t sensor_history_count_ones(history_t *h, uint16_t count)
+{
+	uint16_t ones = 0, start;
+
+	// Positions beyond the size of the history wrap around, as with sensor_history_value()
+	if (count >= HISTORY_BITS)
+	{
+		ones = (count / HISTORY_BITS) * history_count_ones(h->history, 0, HISTORY_BITS);
+		count %= HISTORY_BITS;
+	}
+
+	if (count <= h->end)
+		return ones + history_count_ones(h->history, h->end - count, h->end);
+
+	start = HISTORY_BITS - (count - h->end);
+	return ones + history_count_ones(h->history, 0, h->end) +
+		history_count_ones(h->history, start, HISTORY_BITS);
+}
+
+uint32_t sensor_history_count_ones_within(history_t *h, uint32_t duration, uint16_t period)
+{
+	uint32_t count = duration / (period ? period : 1);
+
+	// Unlike sensor_history_count_ones(), do not wrap around
+	if (count > HISTORY_BITS)
+		count = HISTORY_BITS;
+	return sensor_history_count_ones(h, count);
+}
+
+#endif
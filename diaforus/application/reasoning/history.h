@@ -9,6 +9,39 @@
 #include <stdint.h>
 #include "reasoning_config.h"
 
+/*
+ * Set by reasoning_config.h to store the history as runs of equal values
+ * instead of one bit per value. A run takes 16 bits (the value, then the
+ * length) so the same SENSOR_HISTORY_SIZE bytes hold SENSOR_HISTORY_SIZE / 2 - 1
+ * runs of up to 32767 values each: minutes of a quiet or slowly changing
+ * sensor instead of a few seconds, but a sensor which changes on every poll
+ * (or a SPIRIT barrier with several beams) keeps less than with the bitmap.
+ * The values older than the oldest run read as 0.
+ */
+#ifndef SENSOR_HISTORY_RUNS
+#define SENSOR_HISTORY_RUNS 0
+#endif
+
+#if SENSOR_HISTORY_RUNS
+
+#define SENSOR_HISTORY_RUN_COUNT (SENSOR_HISTORY_SIZE / 2)
+#define SENSOR_HISTORY_RUN_VALUE 0x8000
+#define SENSOR_HISTORY_RUN_LENGTH 0x7fff
+
+/* Longest run sensor_history_add_run() keeps whole */
+#define SENSOR_HISTORY_SPAN_MAX UINT16_MAX
+
+typedef struct
+{
+	uint16_t history[SENSOR_HISTORY_RUN_COUNT]; // oldest run at start, newest before end
+	uint16_t start;
+	uint16_t end;
+} history_t;
+
+#else
+
+#define SENSOR_HISTORY_SPAN_MAX (SENSOR_HISTORY_SIZE * 8)
+
 typedef struct
 {
 	uint8_t history[SENSOR_HISTORY_SIZE];
@@ -16,7 +49,35 @@ typedef struct
 	uint16_t end;
 } history_t;
 
+#endif
+
 uint8_t sensor_history_value(history_t *h, uint16_t pos);
 uint8_t sensor_history_add(history_t *h, uint8_t value);
 
+/*
+ * Append a sample of @width values at once, bit i of @value being stored
+ * before bit i + 1. @width must be a power of two <= 16 and the history must
+ * only be filled with samples of that width, so that one sample always fits
+ * in a single byte (or in two whole bytes).
+ */
+uint16_t sensor_history_add_sample(history_t *h, uint16_t value, uint8_t width);
+
+/* Append @count times the same value, whole bytes at once */
+void sensor_history_add_run(history_t *h, uint8_t value, uint16_t count);
+
+/*
+ * Get the @count (<= 32) most recent values packed in a word, in chronological
+ * order: bit (count - 1 - pos) holds sensor_history_value(h, pos).
+ */
+uint32_t sensor_history_last_bits(history_t *h, uint8_t count);
+
+/* Count the values set among the @count most recent ones (pos 0 to count - 1) */
+uint16_t sensor_history_count_ones(history_t *h, uint16_t count);
+
+/*
+ * Count the values set during the last @duration ms, a value being added
+ * every @period ms. The values older than the history are not counted.
+ */
+uint32_t sensor_history_count_ones_within(history_t *h, uint32_t duration, uint16_t period);
+
 #endif /* HISTORY_H */
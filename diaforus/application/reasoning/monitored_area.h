@@ -13,7 +13,9 @@ typedef struct
 {
     uint8_t area;
     portTickType crossing_duration;
-    uint16_t value;
+    uint16_t value; // criticality of the area in percent of its threshold
+    int32_t slope; // change of value since the previous summary
+    uint32_t involved_sensors;
     portTickType previous_time;
     portTickType time;
 } monitored_area_t;
@@ -16,7 +16,52 @@
 
 #define WELL_KNOWN_VERSION 1
 
-static u8 history_buffer[244]  __attribute__(( section(".slowdata") ));
+/*
+ * The history is sent with the Block option of the CoAP draft, 64 bytes per
+ * block since the payload of a frame is limited to 68 bytes
+ */
+#define HISTORY_BLOCK_SZX 2
+
+static u8 history_buffer[REASONING_HISTORY_SNAPSHOT_MAX]  __attribute__(( section(".slowdata") ));
+static uint16_t history_length;
+static u8 history_etag[4]; // generation and since of the snapshot
+static u8 history_block[3];
+
+#if ROLE_REASONING
+#ifndef CRITICALITY_NOTIFY_DELTA
+#define CRITICALITY_NOTIFY_DELTA 1
+#endif
+
+/*
+ * Observers of criticality_lvl and alert_alarm_ratio (CoAP Observe). The
+ * server of the stack answers requests only, the notifications are built
+ * here and sent as non-confirmable responses carrying the Observe sequence
+ * and the Token of the registration.
+ */
+#define COAP_OBSERVERS_MAX 4
+#define COAP_OBSERVE_CHECK_PERIOD 500 // ms between two checks of the criticality
+#define COAP_TOKEN_MAX 4
+
+enum { OBSERVE_NONE, OBSERVE_CRITICALITY, OBSERVE_RATIO };
+
+typedef struct
+{
+	uip_ipaddr_t addr;
+	u16 port;
+	u8 resource; // OBSERVE_NONE when the entry is free
+	u8 token_len;
+	u8 token[COAP_TOKEN_MAX];
+} coap_observer_t;
+
+static coap_observer_t observers[COAP_OBSERVERS_MAX];
+static u8 observer_count;
+static u16 observe_sequence;
+static u8 observe_option[2];
+static struct uip_udp_conn *observe_conn;
+static portTickType next_observe_check;
+/* Values of the last notifications */
+static uint16_t notified_criticality, notified_alarms;
+#endif
 
 RESOURCE_RW(min_intrusion_duration, get_min_intrusion_duration_handler, set_min_intrusion_duration_handler);
 RESOURCE_RW(max_intrusion_duration, get_max_intrusion_duration_handler, set_max_intrusion_duration_handler);
@@ -26,11 +71,7 @@ RESOURCE_RO(well_known, get_well_known);
 #if ROLE_REASONING
 RESOURCE_RW(hist_analyze_per, get_history_analyze_period_handler, set_history_analyze_period_handler);
 RESOURCE_RO(criticality_lvl, get_criticality_lvl);
-RESOURCE_RO(history_part1, get_history_part1);
-RESOURCE_RO(history_part2, get_history_part2);
-RESOURCE_RO(history_sensor_part1, get_history_sensor_part1);
-RESOURCE_RO(history_sensor_part2, get_history_sensor_part2);
-RESOURCE_RO(history_sensor_part3, get_history_sensor_part3);
+RESOURCE_RO(history, get_history);
 
 RESOURCE_WO(false_positive, report_false_positive);
 RESOURCE_WO(false_negative, report_false_negative);
@@ -48,11 +89,7 @@ void application_coap_service_init()
 #if ROLE_REASONING
     INIT_RESOURCE_RW(hist_analyze_per, get_history_analyze_period_handler, set_history_analyze_period_handler);
     INIT_RESOURCE_RO(criticality_lvl, get_criticality_lvl);
-    INIT_RESOURCE_RO(history_part1, get_history_part1);
-    INIT_RESOURCE_RO(history_part2, get_history_part2);
-    INIT_RESOURCE_RO(history_sensor_part1, get_history_sensor_part1);
-    INIT_RESOURCE_RO(history_sensor_part2, get_history_sensor_part2);
-    INIT_RESOURCE_RO(history_sensor_part3, get_history_sensor_part3);
+    INIT_RESOURCE_RO(history, get_history);
     INIT_RESOURCE_WO(false_positive, report_false_positive);
     INIT_RESOURCE_WO(false_negative, report_false_negative);
 
@@ -67,11 +104,7 @@ void application_coap_service_init()
 #if ROLE_REASONING
     rest_activate_resource(&resource_hist_analyze_per);
     rest_activate_resource(&resource_criticality_lvl);
-    rest_activate_resource(&resource_history_part1);
-    rest_activate_resource(&resource_history_part2);
-    rest_activate_resource(&resource_history_sensor_part1);
-    rest_activate_resource(&resource_history_sensor_part2);
-    rest_activate_resource(&resource_history_sensor_part3);
+    rest_activate_resource(&resource_history);
     rest_activate_resource(&resource_false_positive);
     rest_activate_resource(&resource_false_negative);
 	rest_activate_resource(&resource_alert_alarm_ratio);
@@ -88,42 +121,128 @@ void get_well_known(REQUEST* request, RESPONSE* response) {
 	rest_set_response_status(response, OK_200);
 }
 
+/*
+ * The request payloads are read in place through length-bounded spans. They
+ * hold unsigned integers encoded as in CBOR (major type 0): a value below 24
+ * in the initial byte, otherwise in the 1, 2 or 4 bytes following it
+ * (additional information 24, 25 or 26), in network order.
+ */
+typedef struct
+{
+	const u8 *data;
+	uint16_t len;
+} span_t;
+
+static span_t request_span(REQUEST *request)
+{
+	span_t span = { request->payload, request->payload != NULL ? request->payload_len : 0 };
+
+	return span;
+}
+
+static bool span_get_uint(span_t *span, uint32_t max, uint32_t *value)
+{
+	uint8_t info, size, i;
+
+	if (span->len == 0 || (span->data[0] >> 5) != 0)
+		return false;
+	info = span->data[0] & 0x1f;
+	if (info > 26)
+		return false;
+	size = info < 24 ? 0 : 1 << (info - 24);
+	if (span->len < 1 + size)
+		return false;
+
+	*value = size ? 0 : info;
+	for (i = 1; i <= size; i++)
+		*value = (*value << 8) | span->data[i];
+	span->data += 1 + size;
+	span->len -= 1 + size;
+	return *value <= max;
+}
+
+/* Decimal digits only, e.g. a query variable */
+static bool span_get_decimal(span_t *span, uint32_t max, uint32_t *value)
+{
+	if (span->len == 0)
+		return false;
+	for (*value = 0; span->len > 0; span->data++, span->len--)
+	{
+		if (*span->data < '0' || *span->data > '9')
+			return false;
+		*value = *value * 10 + *span->data - '0';
+		if (*value > max)
+			return false;
+	}
+	return true;
+}
+
+/* The whole payload is one integer */
+static bool read_uint_payload(REQUEST *request, uint32_t max, uint32_t *value)
+{
+	span_t span = request_span(request);
+
+	return span_get_uint(&span, max, value) && span.len == 0;
+}
+
+/*
+ * The durations are read and written in seconds and the analyze period in
+ * minutes, as in the network description. The responses hold them on 16 bits
+ * in network order.
+ */
+static void write_u16_payload(REQUEST *request, RESPONSE *response, uint32_t value)
+{
+	u16 payload = htons(value > UINT16_MAX ? UINT16_MAX : value);
+
+	response->ver = request->ver;
+	response->option_count = 0;
+	response->tid = request->tid;
+	rest_set_payload(response, &payload, sizeof(payload));
+	rest_set_response_status(response, OK_200);
+}
+
+static void write_set_status(REQUEST *request, RESPONSE *response, bool stored)
+{
+	response->ver = request->ver;
+	response->option_count = 0;
+	response->tid = request->tid;
+	rest_set_response_status(response, stored ? OK_200 : BAD_REQUEST_400);
+}
+
 void set_min_intrusion_duration_handler(REQUEST *request, RESPONSE *response)
 {
+	uint32_t seconds;
 
+	write_set_status(request, response, read_uint_payload(request, UINT16_MAX, &seconds)
+			 && set_min_intrusion_duration(seconds * 1000) == 0);
 }
 
 void get_min_intrusion_duration_handler(REQUEST *request, RESPONSE *response)
 {
-
+	write_u16_payload(request, response, get_min_intrusion_duration_setting() / 1000);
 }
 
 void set_max_intrusion_duration_handler(REQUEST *request, RESPONSE *response)
 {
+	uint32_t seconds;
 
+	write_set_status(request, response, read_uint_payload(request, UINT16_MAX, &seconds)
+			 && set_max_intrusion_duration(seconds * 1000) == 0);
 }
 
 void get_max_intrusion_duration_handler(REQUEST *request, RESPONSE *response)
 {
-
+	write_u16_payload(request, response, get_max_intrusion_duration_setting() / 1000);
 }
 
+/* 0 (green) to 3 (red) */
 void set_latency_mode_handler(REQUEST *request, RESPONSE *response)
 {
-	u8 latencies[] = { 100, 75, 50, 25 };
-	u8 id;
+	static const u8 latencies[] = { 100, 75, 50, 25 };
+	uint32_t id;
 
-	if (!strcmp(request->payload, "green"))
-		id = 0;
-	else if (!strcmp(request->payload, "yellow"))
-		id = 1;
-	else if (!strcmp(request->payload, "orange"))
-		id = 2;
-	else if (!strcmp(request->payload, "red"))
-		id = 3;
-	else
-		return;
-	set_latency_mode(latencies[id]);
+	write_set_status(request, response, read_uint_payload(request, sizeof(latencies) - 1, &id)
+			 && set_latency_mode(latencies[id]) == 0);
 }
 
 void get_latency_mode_handler(REQUEST *request, RESPONSE *response)
@@ -131,7 +250,8 @@ void get_latency_mode_handler(REQUEST *request, RESPONSE *response)
 	const char *latencies[] = { "green", "yellow", "orange", "red"};
 	u8 id;
 
-	id = (100 - (get_latency_mode() & 0xff)) / 25;
+	// white (150) is shown as green
+	id = get_latency_mode() >= 100 ? 0 : (100 - get_latency_mode()) / 25;
 	response->ver = request->ver;
 	response->option_count = 0;
 	response->tid = request->tid;
@@ -141,138 +261,287 @@ void get_latency_mode_handler(REQUEST *request, RESPONSE *response)
 
 #if ROLE_REASONING
 
-// In diaforus the maximum data len is 68 bytes
-void get_history_part1(REQUEST *request, RESPONSE *response)
+/*
+ * The snapshot (reasoning_history_snapshot()) is taken when the first block
+ * is requested, the next blocks are cut from it. Each block carries the
+ * generation of its snapshot and the generation it is relative to as ETag,
+ * so that a client restarts from the first block when another one took a
+ * different snapshot in the meantime.
+ *
+ * With the query since=<generation>, only the sensor states of the events
+ * changed after that generation are sent, and nothing (304 Not Modified) when
+ * it is the current one.
+ */
+void get_history(REQUEST *request, RESPONSE *response)
+{
+	header_option_t *option = coap_get_option(request, Option_Type_Block);
+	uint32_t block = 0, num;
+	uint16_t offset, len, generation, since = REASONING_HISTORY_FULL;
+	uint8_t szx = HISTORY_BLOCK_SZX, i, j;
+	char query[6];
+	span_t span;
+	uint32_t value;
+
+	if (option != NULL)
+	{
+		for (i = 0; i < option->len && i < sizeof(history_block); i++)
+			block = (block << 8) | option->value[i];
+		if ((block & 0x7) < szx)
+			szx = block & 0x7;
+	}
+	num = block >> 4;
+
+	span.data = (const u8 *)query;
+	span.len = rest_get_query_variable(request, "since", query, sizeof(query));
+	if (span_get_decimal(&span, UINT16_MAX, &value))
+		since = value;
+
+	response->ver = request->ver;
+	response->option_count = 0;
+	response->tid = request->tid;
+
+	if (num == 0)
+	{
+		generation = reasoning_history_generation();
+		if (since == generation)
+		{
+			rest_set_response_status(response, NOT_MODIFIED_304);
+			return;
+		}
+		history_length = reasoning_history_snapshot(history_buffer, since);
+		history_etag[0] = generation >> 8;
+		history_etag[1] = generation & 0xff;
+		history_etag[2] = since >> 8;
+		history_etag[3] = since & 0xff;
+	}
+	else if ((num << (szx + 4)) >= history_length)
+	{
+		rest_set_response_status(response, BAD_REQUEST_400);
+		return;
+	}
+
+	offset = num << (szx + 4);
+	len = history_length - offset;
+	if (len > (16 << szx))
+		len = 16 << szx;
+
+	// NUM, M and SZX on as few bytes as possible
+	block = (num << 4) | ((offset + len < history_length) << 3) | szx;
+	for (i = 1; i < sizeof(history_block) && (block >> (i * 8)); i++)
+		;
+	for (j = i; j > 0; j--, block >>= 8)
+		history_block[j - 1] = block & 0xff;
+
+	coap_set_option(response, Option_Type_Etag, sizeof(history_etag), history_etag);
+	coap_set_option(response, Option_Type_Block, i, history_block);
+	rest_set_response_status(response, OK_200);
+	rest_set_payload(response, history_buffer + offset, len);
+}
+
+static uint8_t criticality_payload(u16 *payload)
+{
+	payload[0] = htons(get_criticality_threshold());
+	payload[1] = htons(get_criticality_level());
+	return sizeof(u16) * 2;
+}
+
+static uint8_t alert_alarm_ratio_payload(u16 *payload)
 {
-       int i;
-
-       memset(history_buffer, 0, sizeof(history_buffer));
-       reasoning_history_suspicious_events_serialize(history_buffer);
-       response->ver = request->ver;
-       response->option_count = 0;
-       response->tid = request->tid;
-       rest_set_response_status(response, OK_200);
-       rest_set_payload(response, history_buffer, 68);
+	payload[0] = htons(reasoning_alarm_count);
+	payload[1] = htons(reasoning_alert_count);
+	return sizeof(u16) * 2;
 }
 
-void get_history_part2(REQUEST *request, RESPONSE *response)
+static coap_observer_t *find_observer(REQUEST *request, u8 resource)
 {
-       response->ver = request->ver;
-       response->option_count = 0;
-       response->tid = request->tid;
-       rest_set_response_status(response, OK_200);
-       rest_set_payload(response, history_buffer + 68, 12);
+	uint8_t i;
+
+	for (i = 0; i < COAP_OBSERVERS_MAX; i++)
+		if (observers[i].resource == resource && observers[i].port == request->port
+		    && uip_ipaddr_cmp(&observers[i].addr, &request->addr))
+			return &observers[i];
+	return NULL;
+}
+
+/*
+ * A GET with the Observe option registers its sender as observer of the
+ * resource, one without it cancels the registration. The response of a
+ * registration carries the Observe and Token options.
+ */
+static void observe_request(REQUEST *request, RESPONSE *response, u8 resource)
+{
+	header_option_t *observe = coap_get_option(request, Option_Type_Subscription_Lifetime);
+	header_option_t *token = coap_get_option(request, Option_Type_Token);
+	coap_observer_t *observer = find_observer(request, resource);
+	uint8_t i;
+
+	if (observe == NULL)
+	{
+		if (observer != NULL)
+		{
+			observer->resource = OBSERVE_NONE;
+			observer_count--;
+		}
+		return;
+	}
+	for (i = 0; observer == NULL && i < COAP_OBSERVERS_MAX; i++)
+		if (observers[i].resource == OBSERVE_NONE)
+		{
+			observer = &observers[i];
+			observer->resource = resource;
+			observer_count++;
+		}
+	if (observer == NULL)
+		return; // answered as a plain GET
+	if (observer_count == 1)
+		next_observe_check = time_get();
+
+	uip_ipaddr_copy(&observer->addr, &request->addr);
+	observer->port = request->port;
+	observer->token_len = 0;
+	if (token != NULL)
+	{
+		observer->token_len = token->len < COAP_TOKEN_MAX ? token->len : COAP_TOKEN_MAX;
+		memcpy(observer->token, token->value, observer->token_len);
+	}
+	if (resource == OBSERVE_CRITICALITY)
+		notified_criticality = get_criticality_level();
+	else
+		notified_alarms = reasoning_alarm_count;
+
+	observe_option[0] = observe_sequence >> 8;
+	observe_option[1] = observe_sequence & 0xff;
+	coap_set_option(response, Option_Type_Subscription_Lifetime, sizeof(observe_option), observe_option);
+	if (observer->token_len)
+		coap_set_option(response, Option_Type_Token, observer->token_len, observer->token);
 }
 
-void get_history_sensor_part1(REQUEST *request, RESPONSE *response)
+/* Non-confirmable 2.05 with the Observe and Token options, as in the CoAP draft */
+static void notify_observers(u8 resource, const u16 *payload, uint8_t len)
 {
-       response->ver = request->ver;
-       response->option_count = 0;
-       response->tid = request->tid;
-       rest_set_response_status(response, OK_200);
-       rest_set_payload(response, history_buffer + 80, 68);
+	u8 frame[4 + 3 + 1 + COAP_TOKEN_MAX + sizeof(u16) * 2];
+	uint8_t i, n;
+
+	if (observe_conn == NULL)
+		observe_conn = udp_new(NULL, 0, NULL);
+	observe_sequence++;
+	for (i = 0; i < COAP_OBSERVERS_MAX; i++)
+	{
+		if (observers[i].resource != resource)
+			continue;
+		n = 0;
+		frame[n++] = 0x50 | (observers[i].token_len ? 2 : 1);
+		frame[n++] = OK_200;
+		frame[n++] = observe_sequence >> 8;
+		frame[n++] = observe_sequence & 0xff;
+		frame[n++] = (Option_Type_Subscription_Lifetime << 4) | 2;
+		frame[n++] = observe_sequence >> 8;
+		frame[n++] = observe_sequence & 0xff;
+		if (observers[i].token_len)
+		{
+			frame[n++] = ((Option_Type_Token - Option_Type_Subscription_Lifetime) << 4) | observers[i].token_len;
+			memcpy(frame + n, observers[i].token, observers[i].token_len);
+			n += observers[i].token_len;
+		}
+		memcpy(frame + n, payload, len);
+		uip_udp_packet_sendto(observe_conn, frame, n + len, &observers[i].addr, observers[i].port);
+	}
 }
 
-void get_history_sensor_part2(REQUEST *request, RESPONSE *response)
+void reasoning_coap_notify()
 {
-       response->ver = request->ver;
-       response->option_count = 0;
-       response->tid = request->tid;
-       rest_set_response_status(response, OK_200);
-       rest_set_payload(response, history_buffer + 148, 68);
+	uint16_t criticality;
+	u16 payload[2];
+	bool alarm;
+
+	if (observer_count == 0 || (int32_t)(time_get() - next_observe_check) < 0)
+		return;
+	next_observe_check = time_get() + COAP_OBSERVE_CHECK_PERIOD;
+
+	criticality = get_criticality_level();
+	alarm = reasoning_alarm_count != notified_alarms;
+	if (alarm || criticality >= notified_criticality + CRITICALITY_NOTIFY_DELTA
+	    || criticality + CRITICALITY_NOTIFY_DELTA <= notified_criticality)
+	{
+		notified_criticality = criticality;
+		notify_observers(OBSERVE_CRITICALITY, payload, criticality_payload(payload));
+	}
+	if (alarm)
+	{
+		notified_alarms = reasoning_alarm_count;
+		notify_observers(OBSERVE_RATIO, payload, alert_alarm_ratio_payload(payload));
+	}
 }
 
-void get_history_sensor_part3(REQUEST *request, RESPONSE *response)
+portTickType reasoning_coap_next_notify()
 {
-       response->ver = request->ver;
-       response->option_count = 0;
-       response->tid = request->tid;
-       rest_set_response_status(response, OK_200);
-       rest_set_payload(response, history_buffer + 216, 8);
+	return observer_count ? next_observe_check : portMAX_DELAY;
 }
 
 void get_criticality_lvl(REQUEST *request, RESPONSE *response)
 {
         u16 payload[2];
 
-	payload[0] = htons(get_criticality_threshold());
-	payload[1] = htons(get_criticality_level());
 	response->ver = request->ver;
 	response->option_count = 0;
 	response->tid = request->tid;
+	observe_request(request, response, OBSERVE_CRITICALITY);
 	rest_set_response_status(response, OK_200);
-	rest_set_payload(response, payload, sizeof(u16) * 2);
+	rest_set_payload(response, payload, criticality_payload(payload));
 }
 
 void set_history_analyze_period_handler(REQUEST *request, RESPONSE *response)
 {
+	uint32_t minutes;
 
+	write_set_status(request, response, read_uint_payload(request, UINT16_MAX, &minutes)
+			 && set_history_analyze_period(minutes * 60 * 1000) == 0);
 }
 
 void get_history_analyze_period_handler(REQUEST *request, RESPONSE *response)
 {
-
+	write_u16_payload(request, response, get_history_analyze_period_setting() / (60 * 1000));
 }
 
 void get_alert_alarm_ratio(REQUEST* request, RESPONSE* response) {
-	u16 payload[] = { htons(reasoning_alarm_count), htons(reasoning_alert_count) };
+	u16 payload[2];
 
 	response->ver = request->ver;
 	response->option_count = 0;
 	response->tid = request->tid;
-	rest_set_payload(response, payload, sizeof(payload));
+	observe_request(request, response, OBSERVE_RATIO);
+	rest_set_payload(response, payload, alert_alarm_ratio_payload(payload));
 	rest_set_response_status(response, OK_200);
 }
-#endif
 
-unsigned long itoa(const char *str, const char **endstr)
+/* The timestamp and the critical level of the event */
+void report_false_positive(REQUEST *request, RESPONSE *response)
 {
-	unsigned long n = 0;
-	
-	if (endstr)
-			*endstr = str;
+	span_t span = request_span(request);
+	uint32_t timestamp, critical_level;
 
-	while (*str != '\0')
+	if (!span_get_uint(&span, UINT32_MAX, &timestamp) || !span_get_uint(&span, UINT8_MAX, &critical_level)
+	    || span.len != 0)
 	{
-		if (*str >= '0' && *str <= '9')
-			n = n * 10 + (*str) - '0';
-		else
-			return -1;
-
-		str++;
-		if (endstr)
-			*endstr = str;
+		write_set_status(request, response, false);
+		return;
 	}
-
-	return n;
-}
-
-#if ROLE_REASONING
-void report_false_positive(REQUEST *request, RESPONSE *response)
-{
-  timestamp_t timestamp;
-  uint8_t critical_level;
-  char *tmp;
-
-  tmp = __builtin_strchr((char *)request->payload, ':');
-
-  if (!tmp) {
-    //DEBUG("APP", LOG_CRITICAL, "report_false_positive requires at least 2 arguments seperated by ':'\n");
-    return;
-  }
-  
-  *tmp++ = '\0';
-  timestamp = itoa((char*)request->payload, NULL);
-  critical_level = itoa(tmp, NULL);
-  reputation_management_report_false_positive(timestamp, critical_level);
+	reputation_management_report_false_positive(timestamp, critical_level);
+	write_set_status(request, response, true);
 }
 
+/* The timestamp of the intrusion */
 void report_false_negative(REQUEST *request, RESPONSE *response)
 {
-  timestamp_t timestamp;
+	uint32_t timestamp;
 
-  timestamp = itoa((char *)request->payload, NULL);
-  reputation_management_report_false_negative(timestamp);
+	if (!read_uint_payload(request, UINT32_MAX, &timestamp))
+	{
+		write_set_status(request, response, false);
+		return;
+	}
+	reputation_management_report_false_negative(timestamp);
+	write_set_status(request, response, true);
 }
 #endif
 #endif
@@ -10,4 +10,12 @@
 
 typedef enum { false=0, true=1 } bool;
 
+/* Whether tick a comes before tick b, the tick counter may have overflowed in between. portMAX_DELAY stands for never. */
+static inline bool time_before(portTickType a, portTickType b)
+{
+	if (a == portMAX_DELAY || b == portMAX_DELAY)
+		return b == portMAX_DELAY && a != portMAX_DELAY;
+	return (int32_t) (a - b) < 0;
+}
+
 #endif
@@ -19,96 +19,195 @@
 #include "reputation_management.h"
 #include "sensors.h"
 
-#define ALERT_HISTORY_SIZE (SUSPICIOUS_STATE_HISTORY_SIZE * 3)
+/* Alerts kept for the reputation, sized by build_network.py from the expected alert rate */
+#ifndef ALERT_TABLE_SIZE
+#define ALERT_TABLE_SIZE (SUSPICIOUS_STATE_HISTORY_SIZE * 3)
+#endif
+/* Open-addressed map, must be a power of two larger than ALERT_TABLE_SIZE */
+#ifndef ALERT_MAP_SIZE
+#define ALERT_MAP_SIZE 64
+#endif
 
-#if ROLE_REASONING
-typedef struct
-{
-	timestamp_t timestamp;
-	uint8_t critical_level;
-} event_t;
+#if ALERT_MAP_SIZE <= ALERT_TABLE_SIZE || ALERT_MAP_SIZE > 256
+# error "ALERT_MAP_SIZE must be larger than ALERT_TABLE_SIZE and at most 256"
+#endif
 
-typedef struct
-{
-       sensorid_t sensorid;
-       uint16_t involved_events; // bit field
-       uint8_t alarm : 7; // used in at least one alarm
-       uint8_t last_alert : 1;
-       timestamp_t time;
-} alert_t;
+#if ROLE_REASONING
 
 static timestamp_t	last_event_timestamp;
 static timestamp_t	duration = HISTORY_ANALYZE_PERIOD;
-static timestamp_t      last_alarm_emitted;
-static uint32_t         last_involved_sensors;
-static event_t		event_table[SUSPICIOUS_STATE_HISTORY_SIZE] __attribute__ (( section (".slowdata") ));
-static alert_t          alert_table[ALERT_HISTORY_SIZE] __attribute__ (( section (".slowdata") ));
+static uint16_t         history_generation; // bumped each time the events or the sensor states change
+static uint16_t         event_generation[SUSPICIOUS_STATE_HISTORY_SIZE]; // last change of the event or of its sensor states
+/* The events and the alerts are stored as parallel arrays, without padding, each scan reading one of them */
+static timestamp_t	event_timestamp[SUSPICIOUS_STATE_HISTORY_SIZE] __attribute__ (( section (".slowdata") ));
+static uint8_t		event_critical_level[SUSPICIOUS_STATE_HISTORY_SIZE] __attribute__ (( section (".slowdata") ));
+static timestamp_t	alert_time[ALERT_TABLE_SIZE] __attribute__ (( section (".slowdata") ));
+static sensorid_t	alert_sensorid[ALERT_TABLE_SIZE] __attribute__ (( section (".slowdata") ));
+static uint16_t		alert_involved_events[ALERT_TABLE_SIZE] __attribute__ (( section (".slowdata") )); // bit field
+static uint8_t		alert_alarm[ALERT_TABLE_SIZE] __attribute__ (( section (".slowdata") )); // used in at least one alarm
+static uint8_t          alert_used[(ALERT_TABLE_SIZE + 7) / 8]; // bit field of occupied alert slots
+static uint8_t          alert_last[(ALERT_TABLE_SIZE + 7) / 8]; // bit field of the alerts last of their sensor
+static uint8_t          alert_last_map[ALERT_MAP_SIZE]; // sensorid -> last alert of the sensor
 
 sensor_state_t	sensor_state_table[SENSOR_STATE_COUNT] __attribute__ (( section (".slowdata") ));
+uint8_t		sensor_state_head[SUSPICIOUS_STATE_HISTORY_SIZE];
+static uint8_t	sensor_state_free;
 
 extern uint32_t reputation_alarm_count;
 
 /*
- * This function get all events greater than @timestamp, and then
- * for all these events we get the smallest : so we get the nearest event to @timestamp
+ * Occupied event slots, sorted by increasing timestamp.
+ * Slots are never moved (their index is the header referenced by the sensor
+ * states and the alerts), only this index is kept ordered.
  */
-static uint8_t find_next_nearest_event(timestamp_t timestamp, uint8_t id)
+static uint8_t		event_order[SUSPICIOUS_STATE_HISTORY_SIZE];
+static uint8_t		event_count;
+static uint16_t		event_used; // bit field of occupied slots
+static uint32_t		event_base_score[SUSPICIOUS_STATE_HISTORY_SIZE]; // score without the time-dependent bonus
+
+/* Returns the first position in event_order whose timestamp is >= @timestamp */
+static uint8_t event_order_lower_bound(timestamp_t timestamp)
 {
-	timestamp_t smallest = UINT32_MAX;
-	uint8_t index = 255, i = 0;
-	for (i = 0; i < SUSPICIOUS_STATE_HISTORY_SIZE; i++)
+	uint8_t low = 0, high = event_count, middle;
+
+	while (low < high)
 	{
-		if (i == id)
-			continue;
-		if (event_table[i].timestamp >= timestamp &&
-			event_table[i].timestamp <= smallest)
-		{
-			index = i;
-			smallest = event_table[i].timestamp;
-		}
+		middle = (low + high) / 2;
+		if (event_timestamp[event_order[middle]] < timestamp)
+			low = middle + 1;
+		else
+			high = middle;
 	}
-	return index;
+	return low;
 }
 
-static uint8_t find_next_strict_nearest_event(timestamp_t timestamp)
+/* Returns the first position in event_order whose timestamp is > @timestamp */
+static uint8_t event_order_upper_bound(timestamp_t timestamp)
 {
-	timestamp_t smallest = UINT32_MAX;
-	uint8_t index = 255, i = 0;
-	for (i = 0; i < SUSPICIOUS_STATE_HISTORY_SIZE; i++)
+	uint8_t low = 0, high = event_count, middle;
+
+	while (low < high)
 	{
-		if (event_table[i].timestamp > timestamp &&
-			event_table[i].timestamp < smallest)
-		{
-			index = i;
-			smallest = event_table[i].timestamp;
-		}
+		middle = (low + high) / 2;
+		if (event_timestamp[event_order[middle]] <= timestamp)
+			low = middle + 1;
+		else
+			high = middle;
 	}
-	return index;
+	return low;
 }
 
-#warning "FIXME: use log"
-static uint32_t compute_event_score(uint8_t id)
+static uint8_t event_order_position(uint8_t id)
+{
+	uint8_t pos;
+
+	if (!(event_used & (1 << id)))
+		return 255;
+	for (pos = event_order_lower_bound(event_timestamp[id]); pos < event_count; pos++)
+		if (event_order[pos] == id)
+			return pos;
+	return 255;
+}
+
+static inline uint32_t event_base_score_against(uint8_t id, timestamp_t nearest_timestamp)
 {
 	// An alarm is always more important than a suspicious event,
 	// the score must take this criterion in account.
-	uint8_t nearest_index = find_next_nearest_event(event_table[id].timestamp, id);
-	timestamp_t nearest_timestamp = nearest_index == 255 ? last_event_timestamp
-		: event_table[nearest_index].timestamp;
+	timestamp_t timestamp_to_ms = port_tick_to_ms(nearest_timestamp - event_timestamp[id]);
+
+	return (timestamp_to_ms * event_critical_level[id]) + ((event_critical_level[id] & 1) << 30);
+}
+
+/*
+ * The base score of an event only depends on the next nearest event (the
+ * neighbour in event_order), so it has to be refreshed only around the
+ * position where the index is modified.
+ */
+static void refresh_event_base_scores(uint8_t pos)
+{
+	uint8_t i, id;
+
+	for (i = pos > 0 ? pos - 1 : 0; i <= pos + 1 && i < event_count; i++)
+	{
+		id = event_order[i];
+		if (i > 0 && event_timestamp[event_order[i - 1]] == event_timestamp[id])
+			event_base_score[id] = event_base_score_against(id, event_timestamp[id]);
+		else if (i + 1 < event_count)
+			event_base_score[id] = event_base_score_against(id, event_timestamp[event_order[i + 1]]);
+		// The most recent event is scored against last_event_timestamp, see compute_event_scores()
+	}
+}
 
-	timestamp_t timestamp_to_ms = port_tick_to_ms(nearest_timestamp - event_table[id].timestamp);
+static void event_order_insert(uint8_t id)
+{
+	uint8_t pos = event_count;
 
-	uint32_t score = (timestamp_to_ms * event_table[id].critical_level) + ((event_table[id].critical_level & 1) << 30);
-	uint32_t bonus = compute_linear_criticality(event_table[id].timestamp, get_min_intrusion_duration()) * 2 * ((1 << 30) / 100);
+	// New events are almost always the most recent ones, so walk from the tail
+	while (pos > 0 && event_timestamp[event_order[pos - 1]] > event_timestamp[id])
+	{
+		event_order[pos] = event_order[pos - 1];
+		pos--;
+	}
+	event_order[pos] = id;
+	event_count++;
+	event_used |= (1 << id);
+	refresh_event_base_scores(pos);
+}
 
-	//PRINTF("REPUTATION MANAGEMENT: bonus for %u is %u\n", id, bonus);
+static void event_order_remove(uint8_t id)
+{
+	uint8_t pos = event_order_position(id);
 
-	if (bonus + score < score)
-	  score = UINT32_MAX;
-	else
-	  score = bonus + score;
-	
-	//DEBUG("REASONING HISTORY", LOG_CRITICAL, "SCORE: id=%u -> next nearest event has timestamp %u : score=%lu\n", id, nearest_timestamp, score);
-	return score;
+	if (pos == 255)
+		return;
+	event_count--;
+	__builtin_memmove(event_order + pos, event_order + pos + 1, event_count - pos);
+	event_used &= ~(1 << id);
+	refresh_event_base_scores(pos);
+}
+
+static uint8_t find_next_strict_nearest_event(timestamp_t timestamp)
+{
+	uint8_t pos = event_order_upper_bound(timestamp);
+
+	return pos < event_count ? event_order[pos] : 255;
+}
+
+#warning "FIXME: use log"
+/*
+ * Compute the score of every event, free slots get UINT32_MAX.
+ * The base scores are cached, only the bonus depends on the current time. Events
+ * are walked from the most recent one, so the bonus stops being computed as soon
+ * as it drops to zero (it does for all the older events too).
+ */
+static void compute_event_scores(uint32_t scores[SUSPICIOUS_STATE_HISTORY_SIZE])
+{
+	uint8_t i, id, linear_criticality = 100;
+	uint32_t score, bonus;
+
+	__builtin_memset(scores, 0xff, SUSPICIOUS_STATE_HISTORY_SIZE * sizeof(uint32_t));
+
+	for (i = event_count; i > 0; i--)
+	{
+		id = event_order[i - 1];
+
+		if (i == event_count && !(i > 1 && event_timestamp[event_order[i - 2]] == event_timestamp[id]))
+			score = event_base_score_against(id, last_event_timestamp);
+		else
+			score = event_base_score[id];
+
+		if (linear_criticality)
+			linear_criticality = compute_linear_criticality(event_timestamp[id], get_min_intrusion_duration());
+		bonus = linear_criticality * 2 * ((1 << 30) / 100);
+
+		//PRINTF("REPUTATION MANAGEMENT: bonus for %u is %u\n", id, bonus);
+
+		if (bonus + score < score)
+		  score = UINT32_MAX;
+		else
+		  score = bonus + score;
+		scores[id] = score;
+	}
 }
 
 static inline bool duration_has_expired (timestamp_t timestamp)
@@ -116,96 +215,178 @@ static inline bool duration_has_expired (timestamp_t timestamp)
 	return (time_get() - timestamp) >= duration;
 }
 
-static inline bool event_slot_is_free(int slot)
+static inline bool alert_slot_is_free(uint8_t index)
 {
-	return (event_table[slot].timestamp == 0) &&
-		(event_table[slot].critical_level == 0);
+	return !(alert_used[index / 8] & (1 << (index % 8)));
 }
 
-static inline bool alert_slot_is_free(uint8_t index)
+static inline bool alert_is_last(uint8_t index)
+{
+	return alert_last[index / 8] & (1 << (index % 8));
+}
+
+static inline void alert_set_last(uint8_t index, bool last)
+{
+	if (last)
+		alert_last[index / 8] |= 1 << (index % 8);
+	else
+		alert_last[index / 8] &= ~(1 << (index % 8));
+}
+
+static uint8_t alert_find_free_slot(void)
+{
+	uint8_t i;
+
+	for (i = 0; i < sizeof(alert_used); i++)
+		if (alert_used[i] != 0xff)
+			break;
+	// The padding bits of the last byte are not slots
+	if (i == sizeof(alert_used) || i * 8 + __builtin_ctz(~alert_used[i]) >= ALERT_TABLE_SIZE)
+		return UINT8_MAX;
+	return i * 8 + __builtin_ctz(~alert_used[i]);
+}
+
+static inline uint8_t alert_map_hash(sensorid_t sensorid)
+{
+	return (sensorid ^ (sensorid >> 6) ^ ((sensorid >> 8) * 13)) & (ALERT_MAP_SIZE - 1);
+}
+
+/* Returns the position of @sensorid in alert_last_map, or of the empty slot where it belongs */
+static uint8_t alert_map_position(sensorid_t sensorid)
+{
+	uint8_t h = alert_map_hash(sensorid);
+
+	while (alert_last_map[h] != UINT8_MAX && alert_sensorid[alert_last_map[h]] != sensorid)
+		h = (h + 1) & (ALERT_MAP_SIZE - 1);
+	return h;
+}
+
+static inline void alert_map_insert(uint8_t index)
+{
+	alert_last_map[alert_map_position(alert_sensorid[index])] = index;
+}
+
+static void alert_map_remove(sensorid_t sensorid)
 {
-  return (alert_table[index].sensorid == UINT16_MAX) && (alert_table[index].involved_events == 0) && (alert_table[index].alarm == 127) && (alert_table[index].last_alert == 1) && (alert_table[index].time == 0);
+	uint8_t h = alert_map_position(sensorid), i, home;
+
+	if (alert_last_map[h] == UINT8_MAX)
+		return;
+
+	// Backward shift deletion, so that no tombstone is needed
+	for (i = (h + 1) & (ALERT_MAP_SIZE - 1); alert_last_map[i] != UINT8_MAX; i = (i + 1) & (ALERT_MAP_SIZE - 1))
+	{
+		home = alert_map_hash(alert_sensorid[alert_last_map[i]]);
+		if (((i - home) & (ALERT_MAP_SIZE - 1)) >= ((i - h) & (ALERT_MAP_SIZE - 1)))
+		{
+			alert_last_map[h] = alert_last_map[i];
+			h = i;
+		}
+	}
+	alert_last_map[h] = UINT8_MAX;
+}
+
+static void free_alert(uint8_t index)
+{
+	if (alert_is_last(index))
+		alert_map_remove(alert_sensorid[index]);
+	alert_used[index / 8] &= ~(1 << (index % 8));
+	alert_sensorid[index] = UINT16_MAX;
+	alert_involved_events[index] = 0;
+	alert_alarm[index] = 127;
+	alert_set_last(index, true);
+	alert_time[index] = 0;
+}
+
+static inline void release_sensor_state(uint8_t index)
+{
+	__builtin_memset(sensor_state_table + index, 0, sizeof(*sensor_state_table));
+	sensor_state_table[index].next = sensor_state_free;
+	sensor_state_free = index;
+}
+
+static void release_sensor_states(uint8_t header)
+{
+	uint8_t i, next;
+
+	for (i = sensor_state_head[header]; i != SENSOR_STATE_NONE; i = next)
+	{
+		next = sensor_state_table[i].next;
+		release_sensor_state(i);
+	}
+	sensor_state_head[header] = SENSOR_STATE_NONE;
 }
 
 static uint8_t find_suitable_event_index(timestamp_t timestamp, uint8_t critical_level)
 {
         uint8_t index = 0, i = 0;
 	uint32_t score = UINT32_MAX;
+	uint32_t scores[SUSPICIOUS_STATE_HISTORY_SIZE];
 
-	// Find and delete all expired event
-	for (i = 0; i < SUSPICIOUS_STATE_HISTORY_SIZE; i++)
+	// The oldest event is the only one which may have expired first
+	if (event_count && duration_has_expired(event_timestamp[event_order[0]]))
 	{
-		if (duration_has_expired(event_table[i].timestamp))
-		{
-			DEBUG("REASONING HISTORY", LOG_DEBUG, "find_suitable_event_index "
-				"evicted %u (expired)\n", i);
-			index = i;
-			goto remove_subentries;
-		}
+		index = event_order[0];
+		DEBUG("REASONING HISTORY", LOG_DEBUG, "find_suitable_event_index "
+			"evicted %u (expired)\n", index);
+		goto remove_subentries;
 	}
 
 	// If we find a free slot, we get it
-	for (i = 0; i < SUSPICIOUS_STATE_HISTORY_SIZE; i++)
+	if (event_count < SUSPICIOUS_STATE_HISTORY_SIZE)
 	{
-		if (event_slot_is_free(i))
-		{
-			DEBUG("REASONING HISTORY", LOG_DEBUG, "find_suitable_event_index "
-			"found a free slot at %u\n", i);
-			index = i;
-			goto exit;
-		}
+		index = __builtin_ctz(~event_used);
+		DEBUG("REASONING HISTORY", LOG_DEBUG, "find_suitable_event_index "
+		"found a free slot at %u\n", index);
+		goto exit;
 	}
 
+	// Otherwise, we look for the less relevant event (the one with the smallest score)
+	compute_event_scores(scores);
 	for (i = 0; i < SUSPICIOUS_STATE_HISTORY_SIZE; i++)
 	{
-		// Otherwise, we look for the less relevant event (the one with the smallest score)
-		uint32_t tmp = compute_event_score(i);
-		//PRINTF("REASONING HISTORY: event %u has score %u\n", i, tmp);
-		if (tmp < score)
+		//PRINTF("REASONING HISTORY: event %u has score %u\n", i, scores[i]);
+		if (scores[i] < score)
 		{
 			index = i;
-			score = tmp;
+			score = scores[i];
 		}
 	}
 
 remove_subentries:
 	PRINTF("REASONING HISTORY: Removing event %u from history with score %u\n", index, score);
+	event_order_remove(index);
 
-	// When the event_table is full and the less revelant event is found
+	// When the event table is full and the less revelant event is found
 	// we remove every sensors contribution attached to this event
-	for (i = 0; i < SENSOR_STATE_COUNT; i++)
-		if (sensor_state_table[i].header == index)
-			__builtin_memset(sensor_state_table + i, 0, sizeof(*sensor_state_table));
+	release_sensor_states(index);
 	if (score != UINT32_MAX)
 	{
 		DEBUG("REASONING HISTORY", LOG_DEBUG, "REASONING HISTORY: find_suitable_event_index evicted"
 			" index %u with score %u\n", index, score);
 	}
 
-	// Remove the evicted event pointed by "event_table[index]" from alert_table
+	// Remove the evicted event at "index" from the alerts
 	// When an alert obtains "involved_events" equals to zero, the alert is evicted from the table (no longer used)
-	for (i = 0; i < ALERT_HISTORY_SIZE; i++)
+	for (i = 0; i < ALERT_TABLE_SIZE; i++)
 	{
 	        if (alert_slot_is_free(i))
 	            continue;
 		
 		// If this alert was involved for this event, remove the contribution to the event
-		if (alert_table[i].involved_events & (1 << index))
+		if (alert_involved_events[i] & (1 << index))
 		{
-			alert_table[i].involved_events &= ~(1 << index);
+			alert_involved_events[i] &= ~(1 << index);
 		
 			// If the alert is no longer used
-			if (alert_table[i].involved_events == 0)
+			if (alert_involved_events[i] == 0)
 			  {
 			    
 			    // Adjust the reputation for the corresponding sensor
 			    // and then evict the entry from the table
 			    PRINTF("REASONING HISTORY: Removing alert %u\n", i);
 			    reputation_management_auto_adjust(i);
-			    alert_table[i].sensorid = UINT16_MAX;
-			    alert_table[i].alarm = 127;
-			    alert_table[i].last_alert = 1;
-			    alert_table[i].time = 0;
+			    free_alert(i);
 			  }
 		}
 	}
@@ -216,56 +397,75 @@ exit:
 
 static uint8_t find_suitable_sensor_state_index(sensorid_t id, uint8_t contrib_header)
 {
-	uint8_t index = 0, least_relevant_header = 0, i = 0;
+	uint8_t index = SENSOR_STATE_NONE, prev = SENSOR_STATE_NONE, least_relevant_header = 0, i = 0, j;
 	uint32_t score = UINT32_MAX;
-	
-	for (i = 0; i < SENSOR_STATE_COUNT; i++)
+	uint32_t scores[SUSPICIOUS_STATE_HISTORY_SIZE];
+
+	// If we find a free slot, we get it
+	if (sensor_state_free != SENSOR_STATE_NONE)
 	{
-		// If we find a free slot, we get it
-		if (sensor_state_table[i].sensorid == 0 && 
-		sensor_state_table[i].header == 0 &&
-		sensor_state_table[i].contribution == 0)
-		{
-			DEBUG("REASONING HISTORY", LOG_DEBUG, "find_suitable_sensor_state_index "
-			"found a free slot at %u\n", i);
-			return i;
-		}
+		index = sensor_state_free;
+		sensor_state_free = sensor_state_table[index].next;
+		DEBUG("REASONING HISTORY", LOG_DEBUG, "find_suitable_sensor_state_index "
+		"found a free slot at %u\n", index);
+		return index;
 	}
 
-	for (i = 0; i < SENSOR_STATE_COUNT; i++)
+	// Otherwise we look for the less relevant event having sensor states
+	compute_event_scores(scores);
+	for (i = 0; i < SUSPICIOUS_STATE_HISTORY_SIZE; i++)
 	{
-		// Otherwise we look for the less relevant event
-		if (compute_event_score(sensor_state_table[i].header) < score)
+		if (sensor_state_head[i] != SENSOR_STATE_NONE && scores[i] < score)
 		{
 			least_relevant_header = i;
-			score = compute_event_score(sensor_state_table[i].header);
+			score = scores[i];
 		}
 	}
 
 	// Once the less revelant event is found, we look for the
 	// sensor with the smallest contribution
-	index = 0;
-	for (i = 0; i < SENSOR_STATE_COUNT; i++)
+	for (i = SENSOR_STATE_NONE, j = sensor_state_head[least_relevant_header]; j != SENSOR_STATE_NONE;
+	     i = j, j = sensor_state_table[j].next)
 	{
-		if (sensor_state_table[i].header == least_relevant_header &&
-		sensor_state_table[i].contribution < sensor_state_table[index].contribution)
+		if (index == SENSOR_STATE_NONE ||
+		sensor_state_table[j].contribution < sensor_state_table[index].contribution ||
+		(sensor_state_table[j].contribution == sensor_state_table[index].contribution &&
+		 sensor_state_table[j].sensorid < sensor_state_table[index].sensorid))
 		{
-			index = i;
+			index = j;
+			prev = i;
 		}
 	}
+
+	// Unlink it from the event
+	event_generation[least_relevant_header] = history_generation;
+	if (prev == SENSOR_STATE_NONE)
+		sensor_state_head[least_relevant_header] = sensor_state_table[index].next;
+	else
+		sensor_state_table[prev].next = sensor_state_table[index].next;
+
 	DEBUG("REASONING HISTORY", LOG_DEBUG, "REASONING HISTORY: find_suitable_sensor_state_index"
 		" evicted index %u , attached to header %u (score=%u) with "
 		"contribution %u\n", index, least_relevant_header, score);
 	return index;
 }
 
+/* REASONING_HISTORY_FULL is skipped when wrapping around */
+static inline void bump_history_generation(void)
+{
+	if (++history_generation == REASONING_HISTORY_FULL)
+		history_generation++;
+}
+
 static inline void write_event_at(uint8_t index, timestamp_t timestamp, uint8_t critical_level)
 {
 #if IS_SIMU
 	assert (index >= 0 && index < SUSPICIOUS_STATE_HISTORY_SIZE);
 #endif
-	event_table[index].timestamp = timestamp;
-	event_table[index].critical_level = critical_level;
+	event_timestamp[index] = timestamp;
+	event_critical_level[index] = critical_level;
+	event_generation[index] = history_generation;
+	event_order_insert(index);
 }
 
 static inline void write_sensor_state_at(uint8_t index, sensorid_t id, uint8_t contrib_header)
@@ -276,6 +476,8 @@ static inline void write_sensor_state_at(uint8_t index, sensorid_t id, uint8_t c
 	sensor_state_table[index].sensorid = id;
 	sensor_state_table[index].header = contrib_header & 0xf;
 	sensor_state_table[index].contribution = contrib_header >> 4;
+	sensor_state_table[index].next = sensor_state_head[contrib_header & 0xf];
+	sensor_state_head[contrib_header & 0xf] = index;
 }
 
 static uint8_t register_important_event (timestamp_t timestamp, uint8_t criticality_level)
@@ -312,10 +514,10 @@ static uint8_t compute_criticality_history(uint16_t criticality, int criticality
 }
 
 /* Returns the sensor contribution stored in 4 bits */
-static inline uint8_t compute_sensor_contribution(const sensor_update_t *su, uint16_t criticality)
+static inline uint8_t compute_sensor_contribution(uint8_t i, uint16_t criticality)
 {
-        uint8_t reputation = reputation_management_get_sensor_reputation(su->sensor_ID);
-	return (((su->value * compute_linear_criticality(su->time, get_max_intrusion_duration() * 2) * reputation / 100)) * 15) / criticality;
+        uint8_t reputation = reputation_management_get_sensor_reputation(sensors_updates.sensor_ID[i]);
+	return (((sensors_updates.value[i] * compute_linear_criticality(sensors_updates.time[i], get_max_intrusion_duration() * 2) * reputation / 100)) * 15) / criticality;
 }
 
 static uint32_t get_involved_sensors(uint8_t header)
@@ -323,26 +525,14 @@ static uint32_t get_involved_sensors(uint8_t header)
 	uint8_t i;
 	uint32_t value = 0;
 
-	for (i = 0; i < SENSOR_STATE_COUNT; i++)
-	{
-		if (sensor_state_table[i].header == header)
-		{
-			value |= (1 << node_id_from_sensor_id(sensor_state_table[i].sensorid));
-		}
-	}
+	for (i = sensor_state_first(header); i != SENSOR_STATE_NONE; i = sensor_state_next(i))
+		value |= (1 << node_id_from_sensor_id(sensor_state_table[i].sensorid));
 	return value;
 }
 
-static uint8_t find_last_alert_for(sensorid_t sensorid)
+static inline uint8_t find_last_alert_for(sensorid_t sensorid)
 {
-	uint8_t i;
-  
-	for (i = 0; i < ALERT_HISTORY_SIZE; i++)
-	{
-	  if (!alert_slot_is_free(i) && (alert_table[i].sensorid == sensorid) && alert_table[i].last_alert)
-			return i;
-	}
-	return UINT8_MAX;
+	return alert_last_map[alert_map_position(sensorid)];
 }
 
 /* Compare the criticality to the corresponding thresholds and notify the history
@@ -355,13 +545,15 @@ void reasoning_history_update(uint16_t criticality)
 
 	criticality_threshold = get_criticality_threshold();
 
-	if (criticality_threshold == 0)
+	// Nothing to correlate, and the sensor contributions are relative to the criticality
+	if (criticality_threshold == 0 || criticality == 0)
 		return;
 
 	criticality_level = compute_criticality_history(criticality, criticality_threshold,
 				    criticality >= criticality_threshold);
 
 	last_event_timestamp = time_get();
+	bump_history_generation();
 	index = register_important_event(last_event_timestamp, criticality_level);
 
 	DEBUG("REASONING HISTORY", LOG_CRITICAL, "%s : criticality = %u, criticality_level = %u, "
@@ -371,28 +563,28 @@ void reasoning_history_update(uint16_t criticality)
 
 	for (i = 0; i < sensors_updates.size; i++)
 	{
-		contrib_header = compute_sensor_contribution(sensors_updates.sensors + i, criticality);
+		contrib_header = compute_sensor_contribution(i, criticality);
 
 		if (contrib_header == 0)
 			continue;
 
 		DEBUG("REASONING HISTORY", LOG_DEBUG, "%s-%u: has a contribution of %f percent in %f\n",
-			modality_string( modality_from_sensor_id(sensors_updates.sensors[i].sensor_ID) ),
-		      id_from_sensor_id(sensors_updates.sensors[i].sensor_ID), contrib_header / 15.0, criticality);
+			modality_string( modality_from_sensor_id(sensors_updates.sensor_ID[i]) ),
+		      id_from_sensor_id(sensors_updates.sensor_ID[i]), contrib_header / 15.0, criticality);
 
 		contrib_header = (contrib_header << 4) | index;
-		register_sensor_state(sensors_updates.sensors[i].sensor_ID, contrib_header);
+		register_sensor_state(sensors_updates.sensor_ID[i], contrib_header);
 		
 		// Get the corresponding alert (the more recent alert for this sensor)
 
-		alert_index = find_last_alert_for(sensors_updates.sensors[i].sensor_ID);
+		alert_index = find_last_alert_for(sensors_updates.sensor_ID[i]);
 		if (alert_index != UINT8_MAX)
 		{
 		    // Update the alert
 		    PRINTF("REASONING HISTORY: Updating alert at %u with event at %u\n", alert_index, index);
-		    alert_table[alert_index].involved_events |= (1 << index);
+		    alert_involved_events[alert_index] |= (1 << index);
 		    if (criticality_level & 0x1)
-		        alert_table[alert_index].alarm = 1;
+		        alert_alarm[alert_index] = 1;
 		}
 	}
 	
@@ -401,72 +593,73 @@ void reasoning_history_update(uint16_t criticality)
                 reputation_alarm_count++;
 		for (i = 0; i < sensors_updates.size; i++)
 		{
-		  reputation_management_update_alarm_contribution(sensors_updates.sensors[i].sensor_ID);
+		  reputation_management_update_alarm_contribution(sensors_updates.sensor_ID[i]);
 		}
 		
 	        involved_sensors = get_involved_sensors(index);
-		if ((last_involved_sensors == involved_sensors) && ((time_get() - last_alarm_emitted) < get_min_intrusion_duration()))
-		  return;
-		
 		reasoning_emit_alarm((criticality / criticality_threshold) * 100, last_event_timestamp, involved_sensors);
-		last_involved_sensors = involved_sensors;
-		last_alarm_emitted = time_get();
 	}
 }
 
 uint8_t reasoning_history_find_suspicious_event_index(timestamp_t timestamp, uint8_t critical_level)
 {
-	uint8_t i;
-	for (i = 0; i < SUSPICIOUS_STATE_HISTORY_SIZE; i++)
+	uint8_t pos;
+
+	for (pos = event_order_lower_bound(timestamp); pos < event_count; pos++)
 	{
-		if (event_table[i].timestamp == timestamp &&
-		event_table[i].critical_level == critical_level)
-		{
-			return i;
-		}
+		if (event_timestamp[event_order[pos]] != timestamp)
+			break;
+		if (event_critical_level[event_order[pos]] == critical_level)
+			return event_order[pos];
 	}
 	return reasoning_history_find_nearest_event(timestamp);
 }
 
 uint8_t reasoning_history_find_nearest_event(timestamp_t timestamp)
 {
-	uint8_t i = 0, nearest_prev = 0;
+	uint8_t pos = event_order_lower_bound(timestamp);
+	uint8_t nearest_prev = 0;
 	uint8_t nearest_next = find_next_strict_nearest_event(timestamp);
-	timestamp_t largest = 0;
 
-	for (i = 0; i < SUSPICIOUS_STATE_HISTORY_SIZE; i++)
-	{
-		if (event_table[i].timestamp < timestamp &&
-			event_table[i].timestamp > largest)
-		{
-			nearest_prev = i;
-			largest = event_table[i].timestamp;
-		}
-	}
-	timestamp_t prev_diff = timestamp - event_table[nearest_prev].timestamp;
-	timestamp_t next_diff = event_table[nearest_next].timestamp - timestamp;
+	if (pos > 0 && event_timestamp[event_order[pos - 1]] > 0)
+		nearest_prev = event_order[pos - 1];
+	if (nearest_next == 255)
+		return nearest_prev;
+
+	timestamp_t prev_diff = timestamp - event_timestamp[nearest_prev];
+	timestamp_t next_diff = event_timestamp[nearest_next] - timestamp;
 
 	return next_diff >= prev_diff ? nearest_prev : nearest_next;
 }
 
 bool reasoning_history_is_full()
 {
-	volatile uint8_t i;
-	
-	for (i = 0; i < SUSPICIOUS_STATE_HISTORY_SIZE; i++)
-		if (event_slot_is_free(i))
-			return false;
-	return true;
+	return event_count == SUSPICIOUS_STATE_HISTORY_SIZE;
+}
+
+void reasoning_history_occupancy(uint8_t *events, uint8_t *sensor_states, uint8_t *alerts)
+{
+	uint8_t i, count;
+
+	*events = event_count;
+
+	for (i = sensor_state_free, count = 0; i != SENSOR_STATE_NONE; i = sensor_state_next(i))
+		count++;
+	*sensor_states = SENSOR_STATE_COUNT - count;
+
+	for (i = 0, count = 0; i < sizeof(alert_used); i++)
+		count += __builtin_popcount(alert_used[i]);
+	*alerts = count;
 }
 
 uint8_t reasoning_history_get_event_critical_level(uint8_t header)
 {
-	return event_table[header].critical_level;
+	return event_critical_level[header];
 }
 
 timestamp_t reasoning_history_get_event_timestamp(uint8_t header)
 {
-	return event_table[header].timestamp;
+	return event_timestamp[header];
 }
 
 void reasoning_history_set_event_duration(timestamp_t newduration)
@@ -474,98 +667,149 @@ void reasoning_history_set_event_duration(timestamp_t newduration)
 	duration = newduration;
 }
 
+timestamp_t reasoning_history_get_event_duration(void)
+{
+	return duration;
+}
+
 void reasoning_history_init(void)
 {
         uint8_t i;
 
-	last_alarm_emitted = 0;
 	last_event_timestamp = 0;
-	last_involved_sensors = 0;
 	duration = HISTORY_ANALYZE_PERIOD;
-	memset(event_table, 0, SUSPICIOUS_STATE_HISTORY_SIZE * sizeof(event_t));
+	memset(event_timestamp, 0, sizeof(event_timestamp));
+	memset(event_critical_level, 0, sizeof(event_critical_level));
+	memset(event_generation, 0, sizeof(event_generation));
+	event_count = 0;
+	event_used = 0;
 	memset(sensor_state_table, 0, SENSOR_STATE_COUNT * sizeof(sensor_state_t));
+	memset(sensor_state_head, SENSOR_STATE_NONE, SUSPICIOUS_STATE_HISTORY_SIZE);
+	sensor_state_free = SENSOR_STATE_NONE;
+	for (i = SENSOR_STATE_COUNT; i > 0; i--)
+		release_sensor_state(i - 1);
+
+	memset(alert_last_map, UINT8_MAX, ALERT_MAP_SIZE);
+	for (i = 0; i < ALERT_TABLE_SIZE; i++)
+	  free_alert(i);
+	bump_history_generation();
+}
 
-	for (i = 0; i < ALERT_HISTORY_SIZE; i++)
+static u8 *snapshot_put_varint(u8 *p, uint32_t value)
+{
+	while (value >= 0x80)
 	{
-	  alert_table[i].sensorid = UINT16_MAX;
-	  alert_table[i].involved_events = 0;
-	  alert_table[i].alarm = 127;
-	  alert_table[i].last_alert = 1;
-	  alert_table[i].time = 0;
+		*p++ = (value & 0x7f) | 0x80;
+		value >>= 7;
 	}
+	*p++ = value;
+	return p;
 }
 
-void reasoning_history_suspicious_events_serialize(u8 *buffer)
+/* Whether the event changed after the generation @since, which is at most 32767 generations old */
+static inline bool event_changed_since(uint8_t id, uint16_t since)
 {
-   event_t nevent;
-   sensorid_t sensorid;
-   u8 contrib_header;
-   int i = 0, j = 0, index = 0;
+	return (int16_t)(event_generation[id] - since) > 0;
+}
+
+uint16_t reasoning_history_snapshot(u8 *buffer, uint16_t since)
+{
+	u8 *p = buffer, *states;
+	uint8_t pos, id, i;
+	timestamp_t previous = event_count ? event_timestamp[event_order[0]] : 0;
+
+	*p++ = REASONING_HISTORY_SNAPSHOT_VERSION;
+	*p++ = history_generation >> 8;
+	*p++ = history_generation & 0xff;
+	*p++ = SUSPICIOUS_STATE_HISTORY_SIZE;
+	*p++ = event_count;
+	*p++ = previous >> 24;
+	*p++ = (previous >> 16) & 0xff;
+	*p++ = (previous >> 8) & 0xff;
+	*p++ = previous & 0xff;
+
+	for (pos = 0; pos < event_count; pos++)
+	{
+		id = event_order[pos];
+		p = snapshot_put_varint(p, event_timestamp[id] - previous);
+		previous = event_timestamp[id];
+		*p++ = event_critical_level[id];
 
-   for (i = 0; i < SUSPICIOUS_STATE_HISTORY_SIZE; i++)
-   {
-     nevent.timestamp = htonl(event_table[i].timestamp);
-     nevent.critical_level = event_table[i].critical_level;
-     memcpy(buffer + index, &nevent.timestamp, 4);
-     memcpy(buffer + index + 4, &nevent.critical_level, 1);
-     
-     index += 5;
-   }
-   
-   for (j = 0; j < SENSOR_STATE_COUNT; j++)
-   {
-     sensorid = htons(sensor_state_table[j].sensorid);
-     contrib_header = (sensor_state_table[j].contribution << 4 | sensor_state_table[j].header);
-     memcpy(buffer + index, &sensorid, 2);
-     memcpy(buffer + index + 2, &contrib_header, 1);
+		states = p++;
+		if (since != REASONING_HISTORY_FULL && !event_changed_since(id, since))
+		{
+			*states = REASONING_HISTORY_UNCHANGED;
+			continue;
+		}
+		*states = 0;
+		for (i = sensor_state_first(id); i != SENSOR_STATE_NONE; i = sensor_state_next(i))
+		{
+			*p++ = sensor_state_table[i].sensorid >> 8;
+			*p++ = sensor_state_table[i].sensorid & 0xff;
+			*p++ = sensor_state_table[i].contribution;
+			(*states)++;
+		}
+	}
+	return p - buffer;
+}
 
-     index += 3;
-   }
+uint16_t reasoning_history_generation(void)
+{
+	return history_generation;
 }
 
 uint16_t reasoning_history_alert_involved_events(uint8_t index)
 {
-	return alert_table[index].involved_events;
+	return alert_involved_events[index];
 }
 
 uint8_t reasoning_history_alert_involved_in_alarms(uint8_t index)
 {
-	return alert_table[index].alarm;
+	return alert_alarm[index];
 }
 
 sensorid_t reasoning_history_alert_sensorid(uint8_t index)
 {
-	return alert_table[index].sensorid;
+	return alert_sensorid[index];
 }
 
 void reasoning_history_register_new_alert(sensorid_t sensorid, uint16_t involved_events, uint8_t alarm)
 {
-	uint8_t i;
+	uint8_t i, oldest;
 
-	for (i = 0; i < ALERT_HISTORY_SIZE; i++)
+	// A sensor has at most one alert flagged as its last one
+	i = find_last_alert_for(sensorid);
+	if (i != UINT8_MAX)
 	{
-		if (!alert_slot_is_free(i) && (alert_table[i].sensorid == sensorid)) 
+		if ((time_get() - alert_time[i]) <= get_min_intrusion_duration())
 		{
-			if (alert_table[i].last_alert && ((time_get() - alert_table[i].time) <= get_min_intrusion_duration()))
-			{
-				PRINTF("REASONING HISTORY: Merging new alert with slot %u\n", i);
-				goto registering;
-			}
-			else
-				alert_table[i].last_alert = 0;
+			PRINTF("REASONING HISTORY: Merging new alert with slot %u\n", i);
+			goto registering;
 		}
+		alert_map_remove(sensorid);
+		alert_set_last(i, false);
 	}
-	for (i = 0; i < ALERT_HISTORY_SIZE; i++)
+
+	i = alert_find_free_slot();
+	if (i == UINT8_MAX)
 	{
-		if (alert_slot_is_free(i))
-			break;
+		// The table is full, the oldest alert is adjusted and then evicted
+		for (i = 0, oldest = 0; i < ALERT_TABLE_SIZE; i++)
+			if (alert_time[i] < alert_time[oldest])
+				oldest = i;
+		i = oldest;
+		PRINTF("REASONING HISTORY: Removing alert %u (table full)\n", i);
+		reputation_management_auto_adjust(i);
+		free_alert(i);
 	}
 	PRINTF("REASONING HISTORY: Registering new alert at %u\n", i);
+	alert_used[i / 8] |= (1 << (i % 8));
+	alert_sensorid[i] = sensorid;
+	alert_map_insert(i);
 registering:
-	alert_table[i].sensorid = sensorid;
-	alert_table[i].involved_events = involved_events;
-	alert_table[i].alarm = alarm;
-	alert_table[i].last_alert = 1;
-	alert_table[i].time = time_get();
+	alert_involved_events[i] = involved_events;
+	alert_alarm[i] = alarm;
+	alert_set_last(i, true);
+	alert_time[i] = time_get();
 }
 #endif
@@ -23,14 +23,49 @@ timestamp_t reasoning_history_get_event_timestamp(uint8_t header);
 
 void reasoning_history_set_event_duration(timestamp_t newduration);
 
+timestamp_t reasoning_history_get_event_duration(void);
+
 bool reasoning_history_is_full(void);
 
+/* Number of occupied entries in the event, sensor state and alert tables */
+void reasoning_history_occupancy(uint8_t *events, uint8_t *sensor_states, uint8_t *alerts);
+
 void reasoning_history_init(void);
 
-void reasoning_history_suspicious_events_serialize(u8 *buffer);
+/*
+ * Packed snapshot of the suspicious events, big endian:
+ *
+ *   u8 version, u16 generation, u8 capacity of the event table, u8 event count,
+ *   u32 timestamp of the oldest event, then for each event from the oldest:
+ *     varint delta to the timestamp of the previous event (7 bits per byte, low first),
+ *     u8 critical level, u8 sensor state count, then for each sensor state:
+ *       u16 sensor id, u8 contribution
+ *
+ * The generation changes whenever the events or their sensor states do. In a
+ * snapshot relative to an older generation, the sensor state count of the
+ * events left unchanged since is REASONING_HISTORY_UNCHANGED and their states
+ * are omitted; the events missing from the list have been evicted.
+ */
+#define REASONING_HISTORY_SNAPSHOT_VERSION 1
+#define REASONING_HISTORY_SNAPSHOT_MAX (9 + SUSPICIOUS_STATE_HISTORY_SIZE * 7 + SENSOR_CONTRIBUTION_HISTORY_SIZE * 3)
+#define REASONING_HISTORY_UNCHANGED 0xff
+#define REASONING_HISTORY_FULL 0 // never a generation
+
+/*
+ * Write the snapshot relative to the generation @since (REASONING_HISTORY_FULL
+ * for all the sensor states) to @buffer (REASONING_HISTORY_SNAPSHOT_MAX bytes),
+ * returns its length
+ */
+uint16_t reasoning_history_snapshot(u8 *buffer, uint16_t since);
+
+uint16_t reasoning_history_generation(void);
 
 uint16_t reasoning_history_alert_involved_events(uint8_t index);
 
 uint8_t reasoning_history_alert_involved_in_alarms(uint8_t index);
 
+sensorid_t reasoning_history_alert_sensorid(uint8_t index);
+
+void reasoning_history_register_new_alert(sensorid_t sensorid, uint16_t involved_events, uint8_t alarm);
+
 #endif
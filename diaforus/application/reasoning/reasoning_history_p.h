@@ -7,17 +7,36 @@
 #define REASONING_HISTORY_P_H
 
 #include <stdint.h>
+#include "reasoning_config.h"
 #include "sensors.h"
 
 #define SENSOR_STATE_COUNT SENSOR_CONTRIBUTION_HISTORY_SIZE
 
+#define SENSOR_STATE_NONE UINT8_MAX
+
 typedef struct
 {
 	sensorid_t sensorid;
 	uint8_t header : 4;
 	uint8_t contribution: 4;
+	uint8_t next; // next sensor state of the same event (or of the free list)
 } sensor_state_t;
 
 extern sensor_state_t	sensor_state_table[SENSOR_STATE_COUNT];
+extern uint8_t		sensor_state_head[SUSPICIOUS_STATE_HISTORY_SIZE];
+
+/*
+ * Walk the sensor states attached to the event @header:
+ * for (i = sensor_state_first(header); i != SENSOR_STATE_NONE; i = sensor_state_next(i))
+ */
+static inline uint8_t sensor_state_first(uint8_t header)
+{
+	return sensor_state_head[header];
+}
+
+static inline uint8_t sensor_state_next(uint8_t index)
+{
+	return sensor_state_table[index].next;
+}
 
 #endif /* REASONING_HISTORY_P_H */
@@ -23,25 +23,116 @@
 
 /*********** Type definitions ***********/
 #define ERROR_VALUE -1 // not used
-#define KNOWN_NODES_SIZE 16
+#ifndef KNOWN_NODES_SIZE
+#define KNOWN_NODES_SIZE 16 // build_network.py counts the nodes of the area
+#endif
+/* A third of the slots stays free so that the probes remain short */
+#define KNOWN_NODES_SLOTS (KNOWN_NODES_SIZE + KNOWN_NODES_SIZE / 3 + 1)
+#define KNOWN_NODES_NONE UINT8_MAX
+#if KNOWN_NODES_SLOTS >= KNOWN_NODES_NONE
+# error "KNOWN_NODES_SIZE is too large, the slots are indexed on 8 bits"
+#endif
+#define CRITICALITY_NONE UINT8_MAX
+
+/*
+ * Sensor part of the criticality, maintained incrementally. Each alert of
+ * sensors_updates decays linearly from weight = value * reputation to 0 in
+ * duration ms, so the sum of the active alerts at time now is
+ * (weight_sum * (duration - (now - base)) + weighted_time_sum) / duration.
+ * The alerts are chained by time, the ones older than first_active have decayed.
+ */
+typedef struct
+{
+	uint8_t older[ALERT_HISTORY_SIZE];
+	uint8_t newer[ALERT_HISTORY_SIZE];
+	uint16_t weight[ALERT_HISTORY_SIZE]; // 0 once decayed
+	uint8_t oldest, newest, first_active;
+	uint32_t duration;
+	portTickType base;
+	uint32_t weight_sum;
+	uint64_t weighted_time_sum; // sum of weight * (time - base)
+} criticality_accumulator_t;
 
 /*********** Global variables ***********/
 sensors_update_t sensors_updates __attribute__ (( section (".slowdata") ));
+static criticality_accumulator_t criticality_acc __attribute__ (( section (".slowdata") ));
 
 /// Threshold before sending an alarm concerning the whole area
 static int criticality_threshold;
 static int latency_mode = LATENCY_MODE;
 static uint32_t min_intrusion_duration = MIN_INTRUSION_DURATION;
 static uint32_t max_intrusion_duration = MAX_INTRUSION_DURATION;
+static uint32_t alert_coalescing_window = ALERT_COALESCING_WINDOW;
+
+/*
+ * Settings written through CoAP, the reasoning applies them when it is
+ * entered next (reasoning_apply_settings()) so that an evaluation never sees
+ * half of a change. 0 when unchanged.
+ */
+static volatile uint32_t new_min_intrusion_duration, new_max_intrusion_duration;
+static volatile uint32_t new_history_analyze_period;
+
+/// Alerts registered but not evaluated yet, the oldest one arrived at first_pending_alert
+static uint8_t pending_alerts;
+static portTickType first_pending_alert;
 
 static uint8_t reasoning_sub = -1;
 static uint8_t reasoning_bootstraping_sub = -1;
 static uint8_t failure_sub = 0;
 static uint8_t monitored_areas_subs[MONITORED_AREAS_COUNT];
-static uint16_t known_nodes[ KNOWN_NODES_SIZE];
+
+/*
+ * Nodes of the area registered by the bootstrap, keyed by node ID (linear
+ * probing from node ID % KNOWN_NODES_SLOTS). A failed node keeps its slot
+ * until it registers again or another node needs the slot.
+ */
+enum { NODE_EMPTY = 0, NODE_KNOWN, NODE_FAILED };
+static uint8_t known_node_id[KNOWN_NODES_SLOTS];
+static uint8_t known_node_sensors[KNOWN_NODES_SLOTS];
+static uint8_t known_node_state[KNOWN_NODES_SLOTS];
+static uint8_t known_nodes_count; // NODE_KNOWN ones
+static uint16_t known_sensors; // sensors of the NODE_KNOWN nodes
 
 uint16_t reasoning_alarm_count = 0, reasoning_alert_count = 0;
 
+#ifndef AREA_SUMMARY_PERIOD
+#define AREA_SUMMARY_PERIOD 5000 // ms, 0 disables the area summaries
+#endif
+
+/// Criticality of the last area summary published, in percent of the threshold
+static uint16_t summary_percent;
+static portTickType next_summary;
+
+#ifndef ALARM_BUCKET_SIZE
+#define ALARM_BUCKET_SIZE 3
+#endif
+
+/*
+ * An alarm session lasts from the first alarm of an intrusion until no alarm
+ * was raised for max_intrusion_duration. Its first alarm is published at
+ * once, then an update when more nodes are involved, when the criticality
+ * peaks higher or every max_intrusion_duration. The updates are limited by
+ * a token bucket: ALARM_BUCKET_SIZE in a row, then one per
+ * min_intrusion_duration. A publication carries the whole session so far:
+ * peak criticality, involved nodes and duration since its first alert.
+ */
+typedef struct
+{
+	bool open;
+	bool changed; // since the last publication
+	uint16_t peak;
+	uint16_t alarms;
+	uint32_t involved_sensors;
+	timestamp_t first_alert, last_alarm;
+	uint32_t published_sensors;
+	uint16_t published_peak;
+	timestamp_t last_publication; // last_alarm when it was published
+	uint8_t tokens;
+	portTickType refill; // next token
+} alarm_session_t;
+
+static alarm_session_t alarm_session;
+
 /*********** COAP accessors/mutators ***********/
 int
 get_criticality_threshold()
@@ -77,10 +168,30 @@ get_max_intrusion_duration()
 	return max_intrusion_duration;
 }
 
+/* The value a getter will return once the pending settings are applied */
+static inline uint32_t setting(uint32_t current, uint32_t pending)
+{
+	return pending ? pending : current;
+}
+
+uint32_t
+get_max_intrusion_duration_setting()
+{
+	return setting(max_intrusion_duration, new_max_intrusion_duration);
+}
+
 int
 set_max_intrusion_duration(uint32_t duration)
 {
+	// the criticality decays over twice this duration
+	if (duration == 0 || duration > UINT32_MAX / 2 ||
+	    duration < setting(min_intrusion_duration, new_min_intrusion_duration))
+		return ERROR_VALUE;
+#if ROLE_REASONING
+	new_max_intrusion_duration = duration;
+#else
 	max_intrusion_duration = duration;
+#endif
 	return 0;
 }
 
@@ -90,31 +201,98 @@ get_min_intrusion_duration()
 	return min_intrusion_duration;
 }
 
+uint32_t
+get_min_intrusion_duration_setting()
+{
+	return setting(min_intrusion_duration, new_min_intrusion_duration);
+}
+
 int
 set_min_intrusion_duration(uint32_t duration)
 {
+	if (duration == 0 || duration > setting(max_intrusion_duration, new_max_intrusion_duration))
+		return ERROR_VALUE;
+#if ROLE_REASONING
+	new_min_intrusion_duration = duration;
+#else
 	min_intrusion_duration = duration;
+#endif
 	return 0;
 }
 
 #if ROLE_REASONING
+uint32_t
+get_history_analyze_period()
+{
+	return reasoning_history_get_event_duration();
+}
+
+uint32_t
+get_history_analyze_period_setting()
+{
+	return setting(reasoning_history_get_event_duration(), new_history_analyze_period);
+}
+
+int
+set_history_analyze_period(uint32_t period)
+{
+	if (period == 0)
+		return ERROR_VALUE;
+	new_history_analyze_period = period;
+	return 0;
+}
+#endif
+
+uint32_t
+get_alert_coalescing_window()
+{
+	return alert_coalescing_window;
+}
+
+int
+set_alert_coalescing_window(uint32_t window)
+{
+	alert_coalescing_window = window;
+	return 0;
+}
+
+#if ROLE_REASONING
+
+/*
+ * Takes the settings written since the previous call. They are read and
+ * cleared together, so that a value written meanwhile is kept for the next call.
+ */
+static void reasoning_apply_settings()
+{
+	uint32_t min, max, period;
+
+	taskENTER_CRITICAL();
+	min = new_min_intrusion_duration;
+	max = new_max_intrusion_duration;
+	period = new_history_analyze_period;
+	new_min_intrusion_duration = 0;
+	new_max_intrusion_duration = 0;
+	new_history_analyze_period = 0;
+	taskEXIT_CRITICAL();
+
+	if (min != 0)
+		min_intrusion_duration = min;
+	if (max != 0)
+		max_intrusion_duration = max;
+	if (period != 0)
+		reasoning_history_set_event_duration(period);
+}
 
 /******** Sensor history helpers ********/
 
 static uint8_t sensors_find_suitable_index(sensorid_t sensor_ID)
 {
-	portTickType duration = time_get() - sensors_updates.sensors[0].time;
-	uint8_t i, oldest = 0;
+	uint8_t i;
 
 	for (i = 0; i < sensors_updates.size; i++)
 	{
-		if (sensors_updates.sensors[i].sensor_ID == sensor_ID)
+		if (sensors_updates.sensor_ID[i] == sensor_ID)
 			return i;
-		if (time_get() - sensors_updates.sensors[i].time > duration)
-		{
-			oldest = i;
-			duration = time_get() - sensors_updates.sensors[i].time;
-		}
 	}
 
 	/* this sensor_id isn't in the table:
@@ -124,29 +302,171 @@ static uint8_t sensors_find_suitable_index(sensorid_t sensor_ID)
 	if (sensors_updates.size < ALERT_HISTORY_SIZE)
 		return sensors_updates.size++;
 	else
-		return oldest;
+		return criticality_acc.oldest;
 }
 
+/******** Criticality accumulator ********/
 
-static void sensor_add_event(sensorid_t sensor_ID, value_t value)
+static void criticality_reset()
 {
-	uint8_t index = sensors_find_suitable_index(sensor_ID);
+	memset(&criticality_acc, 0, sizeof(criticality_acc));
+	memset(criticality_acc.older, CRITICALITY_NONE, sizeof(criticality_acc.older));
+	memset(criticality_acc.newer, CRITICALITY_NONE, sizeof(criticality_acc.newer));
+	criticality_acc.oldest = CRITICALITY_NONE;
+	criticality_acc.newest = CRITICALITY_NONE;
+	criticality_acc.first_active = CRITICALITY_NONE;
+	criticality_acc.duration = get_max_intrusion_duration() * 2;
+}
+
+static inline void criticality_sum_add(uint8_t i)
+{
+	criticality_acc.weight_sum += criticality_acc.weight[i];
+	criticality_acc.weighted_time_sum += (uint64_t) criticality_acc.weight[i] *
+		(sensors_updates.time[i] - criticality_acc.base);
+}
+
+static inline void criticality_sum_remove(uint8_t i)
+{
+	criticality_acc.weight_sum -= criticality_acc.weight[i];
+	criticality_acc.weighted_time_sum -= (uint64_t) criticality_acc.weight[i] *
+		(sensors_updates.time[i] - criticality_acc.base);
+	criticality_acc.weight[i] = 0;
+}
+
+/* Takes the alert at index i out of the time chain (it is about to be replaced) */
+static void criticality_unlink(uint8_t i)
+{
+	uint8_t older = criticality_acc.older[i], newer = criticality_acc.newer[i];
 
-	sensors_updates.sensors[index].sensor_ID = sensor_ID;
-	sensors_updates.sensors[index].time = time_get();
-	sensors_updates.sensors[index].value = value;
+	if (older == CRITICALITY_NONE && criticality_acc.oldest != i)
+		return;
+
+	criticality_sum_remove(i);
+	if (criticality_acc.first_active == i)
+		criticality_acc.first_active = newer;
+	if (older != CRITICALITY_NONE)
+		criticality_acc.newer[older] = newer;
+	else
+		criticality_acc.oldest = newer;
+	if (newer != CRITICALITY_NONE)
+		criticality_acc.older[newer] = older;
+	else
+		criticality_acc.newest = older;
+	criticality_acc.older[i] = CRITICALITY_NONE;
+	criticality_acc.newer[i] = CRITICALITY_NONE;
+}
+
+/* Chains the alert just stored at index i, it is the most recent one */
+static void criticality_link(uint8_t i)
+{
+	uint8_t reputation = reputation_management_get_sensor_reputation(sensors_updates.sensor_ID[i]);
+
+	criticality_acc.older[i] = criticality_acc.newest;
+	if (criticality_acc.newest != CRITICALITY_NONE)
+		criticality_acc.newer[criticality_acc.newest] = i;
+	else
+		criticality_acc.oldest = i;
+	criticality_acc.newest = i;
+
+	// No active alert left, the sums are empty and can be rebased
+	if (criticality_acc.first_active == CRITICALITY_NONE)
+	{
+		criticality_acc.first_active = i;
+		criticality_acc.base = sensors_updates.time[i];
+	}
+	criticality_acc.weight[i] = sensors_updates.value[i] * reputation;
+	criticality_sum_add(i);
+}
+
+/* Drops the alerts which decayed to 0 from the sums */
+static void criticality_expire(portTickType now)
+{
+	uint8_t i;
+
+	while ((i = criticality_acc.first_active) != CRITICALITY_NONE &&
+	       now - sensors_updates.time[i] >= criticality_acc.duration)
+	{
+		criticality_sum_remove(i);
+		criticality_acc.first_active = criticality_acc.newer[i];
+	}
+}
+
+/* Recomputes the sums from scratch, after a change of a reputation or of the intrusion duration */
+void reasoning_criticality_refresh()
+{
+	portTickType now = time_get();
+	uint8_t i, reputation;
+
+	criticality_acc.duration = get_max_intrusion_duration() * 2;
+	criticality_acc.first_active = CRITICALITY_NONE;
+	criticality_acc.weight_sum = 0;
+	criticality_acc.weighted_time_sum = 0;
+
+	for (i = criticality_acc.oldest; i != CRITICALITY_NONE; i = criticality_acc.newer[i])
+	{
+		criticality_acc.weight[i] = 0;
+		if (now - sensors_updates.time[i] >= criticality_acc.duration)
+			continue;
+		if (criticality_acc.first_active == CRITICALITY_NONE)
+		{
+			criticality_acc.first_active = i;
+			criticality_acc.base = sensors_updates.time[i];
+		}
+		reputation = reputation_management_get_sensor_reputation(sensors_updates.sensor_ID[i]);
+		criticality_acc.weight[i] = sensors_updates.value[i] * reputation;
+		criticality_sum_add(i);
+	}
+}
+
+static uint16_t sensors_criticality()
+{
+	portTickType now = time_get();
+	uint64_t sum;
 
+	if (criticality_acc.duration != get_max_intrusion_duration() * 2)
+		reasoning_criticality_refresh();
+	if (criticality_acc.duration == 0)
+		return 0;
+
+	criticality_expire(now);
+	if (criticality_acc.weight_sum == 0)
+		return 0;
+
+	// Every active alert verifies time - base + duration > now - base
+	sum = (uint64_t) criticality_acc.weight_sum * criticality_acc.duration + criticality_acc.weighted_time_sum;
+	sum -= (uint64_t) criticality_acc.weight_sum * (now - criticality_acc.base);
+	return sum / criticality_acc.duration;
+}
+
+/* Correlates the alerts registered since the last evaluation */
+static void evaluate_pending_alerts(void)
+{
 	uint16_t criticality = get_criticality_level();
 
+	DEBUG("REASONING", LOG_CRITICAL, "Evaluating %u alert(s) received in %ums. Criticality = %u\n",
+	      pending_alerts, time_get() - first_pending_alert, criticality);
+
+	pending_alerts = 0;
+	reasoning_history_update(criticality);
+}
+
+static void sensor_add_event(sensorid_t sensor_ID, value_t value)
+{
+	uint8_t index = sensors_find_suitable_index(sensor_ID);
+
+	criticality_unlink(index);
+	sensors_updates.sensor_ID[index] = sensor_ID;
+	sensors_updates.time[index] = time_get();
+	sensors_updates.value[index] = value;
+	criticality_link(index);
+
 	reasoning_alert_count++;
 
-	DEBUG("REASONING", LOG_CRITICAL, "Received alert from NODE_ID = %d, modality = %s, ID = %d, value = %d. "
-	       "Criticality = %u\n",
+	DEBUG("REASONING", LOG_CRITICAL, "Received alert from NODE_ID = %d, modality = %s, ID = %d, value = %d\n",
 	       node_id_from_sensor_id(sensor_ID),
 	       modality_string(modality_from_sensor_id(sensor_ID)),
 	       id_from_sensor_id(sensor_ID),
-	       value,
-	       criticality);
+	       value);
 
 	/*if (reasoning_history_is_full())
 	{
@@ -154,22 +474,33 @@ static void sensor_add_event(sensorid_t sensor_ID, value_t value)
 		reputation_management_undo_tp(sensor_ID);
 		}*/
 	reasoning_history_register_new_alert(sensor_ID, 0, 0);
-	reasoning_history_update(criticality);
+
+	// Alerts of a same crossing are evaluated together, at most alert_coalescing_window after the first one
+	if (pending_alerts++ == 0)
+		first_pending_alert = time_get();
+	if (pending_alerts == UINT8_MAX || time_get() - first_pending_alert >= alert_coalescing_window)
+		evaluate_pending_alerts();
 }
 
 #if MONITORED_AREAS_COUNT
-static void area_add_event(uint8_t index, uint16_t percent)
+static void area_add_summary(uint8_t index, const value_t values[])
 {
-	monitored_areas[index].value = percent;
+	// values[0] : area, values[1] : criticality in percent of its threshold,
+	// values[2] : change since its previous summary, values[3] : nodes with active alerts
+	monitored_areas[index].value = values[1];
+	monitored_areas[index].slope = (int32_t) values[2];
+	monitored_areas[index].involved_sensors = values[3];
 	monitored_areas[index].previous_time = monitored_areas[index].time;
 	monitored_areas[index].time = time_get();
 	
 #if IS_SIMU
 	uint16_t criticality = get_criticality_level();
 	
-	DEBUG("REASONING", LOG_CRITICAL, "Received alarm from monitored area = %u, percent = %u. Criticality = %u\n",
+	DEBUG("REASONING", LOG_CRITICAL, "Received summary from monitored area = %u, percent = %u, slope = %d, nodelist = %u. Criticality = %u\n",
 	       monitored_areas[index].area,
-	       percent,
+	       monitored_areas[index].value,
+	       monitored_areas[index].slope,
+	       monitored_areas[index].involved_sensors,
 	       criticality);
 #endif
 }
@@ -177,12 +508,77 @@ static void area_add_event(uint8_t index, uint16_t percent)
 
 static void compute_criticality_threshold()
 {
-	int nb_sensors = 0, i;
-	for (i = 0; i <  KNOWN_NODES_SIZE; i++) {
-			if (known_nodes[i] != 0)
-				nb_sensors += known_nodes[i] & 0xff;
+	criticality_threshold = known_sensors * 150;
+}
+
+/********** Known nodes **********/
+
+static void known_nodes_reset()
+{
+	memset(known_node_state, NODE_EMPTY, sizeof(known_node_state));
+	known_nodes_count = 0;
+	known_sensors = 0;
+}
+
+/* Slot of the node, KNOWN_NODES_NONE if it never registered */
+static uint8_t known_nodes_lookup(uint8_t node_id)
+{
+	uint8_t i, slot = node_id % KNOWN_NODES_SLOTS;
+
+	for (i = 0; i < KNOWN_NODES_SLOTS; i++, slot = (slot + 1) % KNOWN_NODES_SLOTS)
+	{
+		if (known_node_state[slot] == NODE_EMPTY)
+			break;
+		if (known_node_id[slot] == node_id)
+			return slot;
 	}
-	criticality_threshold = nb_sensors * 150;
+	return KNOWN_NODES_NONE;
+}
+
+/*
+ * Registers the node (again) with its sensor count, the first slot of its
+ * probe sequence that is not taken by a known node evicts a failed one.
+ * Returns false when the table is full.
+ */
+static bool known_nodes_register(uint8_t node_id, uint8_t sensors)
+{
+	uint8_t i, slot = known_nodes_lookup(node_id);
+
+	if (slot != KNOWN_NODES_NONE && known_node_state[slot] == NODE_KNOWN)
+	{
+		known_sensors -= known_node_sensors[slot];
+		known_nodes_count--;
+	}
+	else if (known_nodes_count == KNOWN_NODES_SIZE)
+		return false;
+	else if (slot == KNOWN_NODES_NONE)
+	{
+		slot = node_id % KNOWN_NODES_SLOTS;
+		for (i = 0; known_node_state[slot] == NODE_KNOWN; i++, slot = (slot + 1) % KNOWN_NODES_SLOTS)
+		{
+			if (i == KNOWN_NODES_SLOTS)
+				return false;
+		}
+	}
+	known_node_id[slot] = node_id;
+	known_node_sensors[slot] = sensors;
+	known_node_state[slot] = NODE_KNOWN;
+	known_nodes_count++;
+	known_sensors += sensors;
+	return true;
+}
+
+/* Returns false when the node is not known */
+static bool known_nodes_fail(uint8_t node_id)
+{
+	uint8_t slot = known_nodes_lookup(node_id);
+
+	if (slot == KNOWN_NODES_NONE || known_node_state[slot] != NODE_KNOWN)
+		return false;
+	known_node_state[slot] = NODE_FAILED;
+	known_nodes_count--;
+	known_sensors -= known_node_sensors[slot];
+	return true;
 }
 
 /********** Sensor correlation **********/
@@ -192,32 +588,144 @@ static void compute_criticality_threshold()
 uint16_t get_criticality_level()
 {
 	uint16_t criticality = 0;
-	uint8_t i, reputation;
-
 #if MONITORED_AREAS_COUNT
+	uint8_t i;
+
+	// Second tier: the summaries of the monitored areas decay over their crossing duration
 	for (i = 0; i < MONITORED_AREAS_COUNT; i++)
 	{
-		uint8_t value = 2;
+		// An intrusion growing next door is more likely to come this way
+		uint8_t weight = monitored_areas[i].slope > 0 ? 3 : 2;
+		uint16_t percent = monitored_areas[i].value > 100 ? 100 : monitored_areas[i].value;
 		uint32_t linear_time =  monitored_areas[i].crossing_duration + get_max_intrusion_duration() * 2;
 
-		if (monitored_areas[i].previous_time && (monitored_areas[i].time - monitored_areas[i].previous_time <= linear_time)) {
-			value++;
-			if (value > 3)
-				value = 3;
-		}
-		criticality += compute_linear_criticality(monitored_areas[i].time, linear_time) * value;
+		criticality += compute_linear_criticality(monitored_areas[i].time, linear_time) * weight * percent / 100;
 	}
 #endif
 
-	if (criticality > (get_criticality_threshold() * 0.5))
-		criticality = get_criticality_threshold() * 0.5;
-	
-	for (i = 0; i < sensors_updates.size; i++)
+	if (criticality > get_criticality_threshold() / 2)
+		criticality = get_criticality_threshold() / 2;
+
+	return criticality + sensors_criticality();
+}
+
+/********** Area summaries **********/
+
+#if AREA_SUMMARY_PERIOD
+/*
+ * Publishes the summary of the area for the reasoning nodes monitoring it:
+ * criticality of its sensors in percent of the threshold, change since the
+ * previous summary and nodes whose alerts are still active. A quiet area
+ * publishes nothing but the summary telling it went quiet.
+ */
+static void area_publish_summary(portTickType now)
+{
+	const char * pubAttributes[] = { "SumAr", "SumCrt", "SumSlp", "SumLst" };
+	value_t pubValues[4];
+	int threshold = get_criticality_threshold();
+	uint32_t percent = 0, involved_sensors = 0;
+	uint8_t i;
+
+	next_summary = now + AREA_SUMMARY_PERIOD;
+	// The monitored areas are left out, neighbours monitoring each other would echo
+	if (threshold > 0)
+		percent = (uint32_t) sensors_criticality() * 100 / threshold;
+	if (percent > UINT16_MAX)
+		percent = UINT16_MAX;
+	if (percent == 0 && summary_percent == 0)
+		return;
+
+	for (i = criticality_acc.first_active; i != CRITICALITY_NONE; i = criticality_acc.newer[i])
+		involved_sensors |= (1 << node_id_from_sensor_id(sensors_updates.sensor_ID[i]));
+
+	pubValues[0] = AREA_ID;
+	pubValues[1] = percent;
+	pubValues[2] = (int32_t) percent - summary_percent;
+	pubValues[3] = involved_sensors;
+	summary_percent = percent;
+
+	DEBUG("REASONING", LOG_INFO, "Sending the area summary : percent = %u, slope = %d, nodelist = %u\n",
+	      percent, (int32_t) pubValues[2], involved_sensors);
+	Publish(pubAttributes, pubValues, 4, 0);
+}
+#endif
+
+/********** Alarm sessions **********/
+
+/* Time of the oldest alert still weighing on the criticality, the beginning of the intrusion */
+static timestamp_t first_active_alert(timestamp_t timestamp)
+{
+	criticality_expire(time_get());
+	if (criticality_acc.first_active == CRITICALITY_NONE)
+		return timestamp;
+	return sensors_updates.time[criticality_acc.first_active];
+}
+
+static void alarm_session_publish(portTickType now)
+{
+	const char * pubAttributes[] = { "AlmLvl", "AlmTsp", "AlmAr", "AlmLst", "AlmDrt" };
+	value_t pubValues[] = { alarm_session.peak / 100, alarm_session.last_alarm, AREA_ID,
+				alarm_session.involved_sensors, alarm_session.last_alarm - alarm_session.first_alert };
+
+	if (alarm_session.tokens == ALARM_BUCKET_SIZE)
+		alarm_session.refill = now + get_min_intrusion_duration();
+	if (alarm_session.tokens > 0)
+		alarm_session.tokens--;
+	alarm_session.changed = false;
+	alarm_session.published_sensors = alarm_session.involved_sensors;
+	alarm_session.published_peak = alarm_session.peak;
+	alarm_session.last_publication = alarm_session.last_alarm;
+	reasoning_alarm_count++;
+
+	DEBUG("REASONING", LOG_INFO, "Sending an alarm : criticality = %u, timestamp = %u, area = %u, nodelist = %u, duration = %u, "
+	      "alarms = %u, ratio = %f (%u/%u)\n",
+	      pubValues[0], pubValues[1], AREA_ID, pubValues[3], pubValues[4], alarm_session.alarms,
+	      (float)reasoning_alarm_count/reasoning_alert_count, reasoning_alarm_count, reasoning_alert_count);
+
+	Publish(pubAttributes, pubValues, 5, 0);
+}
+
+/* Publishes what changed in the session if the bucket allows it, closes the session once the intrusion is over */
+static void alarm_session_update(portTickType now)
+{
+	if (!alarm_session.open)
+		return;
+
+	while (alarm_session.tokens < ALARM_BUCKET_SIZE && now >= alarm_session.refill)
+	{
+		alarm_session.tokens++;
+		alarm_session.refill += get_min_intrusion_duration();
+	}
+
+	if (now - alarm_session.last_alarm >= get_max_intrusion_duration())
 	{
-		reputation = reputation_management_get_sensor_reputation(sensors_updates.sensors[i].sensor_ID);
-		criticality += (compute_linear_criticality(sensors_updates.sensors[i].time, get_max_intrusion_duration() * 2) * sensors_updates.sensors[i].value * reputation/100);
+		// The final state of the intrusion is published whatever the bucket
+		if (alarm_session.changed)
+			alarm_session_publish(now);
+		DEBUG("REASONING", LOG_INFO, "Alarm session closed: %u alarms in %u ms\n",
+		      alarm_session.alarms, alarm_session.last_alarm - alarm_session.first_alert);
+		alarm_session.open = false;
 	}
-	return criticality;
+	else if (alarm_session.changed && alarm_session.tokens > 0)
+		alarm_session_publish(now);
+}
+
+static portTickType alarm_session_next_update()
+{
+	portTickType next;
+
+	if (!alarm_session.open)
+		return portMAX_DELAY;
+	next = alarm_session.last_alarm + get_max_intrusion_duration();
+	if (alarm_session.changed && time_before(alarm_session.refill, next))
+		next = alarm_session.refill;
+	return next;
+}
+
+static void alarm_session_reset()
+{
+	memset(&alarm_session, 0, sizeof(alarm_session));
+	alarm_session.tokens = ALARM_BUCKET_SIZE;
 }
 
 /*********** Public functions ***********/
@@ -247,11 +755,16 @@ reasoning_init()
 		reasoning_sub = -1;
 		reasoning_bootstraping_sub = -1;
 		failure_sub = 0;
-		memset(sensors_updates.sensors, 0, ALERT_HISTORY_SIZE * sizeof(sensor_update_t));
+		memset(&sensors_updates, 0, sizeof(sensors_updates));
+		criticality_reset();
 		memset(monitored_areas_subs, 0, MONITORED_AREAS_COUNT);
-		memset(known_nodes, 0, KNOWN_NODES_SIZE * sizeof(uint16_t));
+		known_nodes_reset();
 		reasoning_alarm_count = 0;
+		alarm_session_reset();
 		reasoning_alert_count = 0;
+		pending_alerts = 0;
+		summary_percent = 0;
+		next_summary = time_get() + AREA_SUMMARY_PERIOD;
 
 	    // Alerts subscriptions
 
@@ -277,33 +790,30 @@ reasoning_init()
 
 		reasoning_bootstraping_sub = Subscribe(subListAttributes, subListOperators, subListValues, 3);
 
-		// Areas monitoring subscription(s)
+		// Areas monitoring subscription(s), to their summaries
 
-		subListAttributes[0] = "AlmLvl";
-		subListAttributes[1] = "AlmTsp";
-		subListAttributes[2] = "AlmAr";
-		subListAttributes[3] = "AlmLst";
-		subListAttributes[4] = "AlmDrt";
+		subListAttributes[0] = "SumAr";
+		subListAttributes[1] = "SumCrt";
+		subListAttributes[2] = "SumSlp";
+		subListAttributes[3] = "SumLst";
 
-		subListOperators[0] = GE;
+		subListOperators[0] = EQ;
 		subListOperators[1] = GE;
-		subListOperators[2] = EQ;
+		subListOperators[2] = GE;
 		subListOperators[3] = GE;
-		subListOperators[4] = GE;
 		
-		subListValues[0] = 0;
 		subListValues[1] = 0;
+		subListValues[2] = 0;
 		subListValues[3] = 0;
-		subListValues[4] = 0;
 
 #if MONITORED_AREAS_COUNT
 		for (i = 0; i < MONITORED_AREAS_COUNT; i++)
 		{
-			subListValues[2] = monitored_areas[i].area;
-			monitored_areas_subs[i] = Subscribe(subListAttributes, subListOperators, subListValues, 5);
+			subListValues[0] = monitored_areas[i].area;
+			monitored_areas_subs[i] = Subscribe(subListAttributes, subListOperators, subListValues, 4);
 		}
 #endif
-		compute_criticality_threshold(AREA_ID, sensor_count);
+		compute_criticality_threshold();
 
 		// Subscription for node failure
 
@@ -324,6 +834,10 @@ reasoning_init()
 		DEBUG("REASONING", LOG_DEBUG, "None\n");
 	min_intrusion_duration = MIN_INTRUSION_DURATION;
 	max_intrusion_duration = MAX_INTRUSION_DURATION;
+	alert_coalescing_window = ALERT_COALESCING_WINDOW;
+	new_min_intrusion_duration = 0;
+	new_max_intrusion_duration = 0;
+	new_history_analyze_period = 0;
 }
 
 int
@@ -331,28 +845,23 @@ reasoning_update(const char * const attributes[], const value_t values[], uint8_
 {
         uint8_t i;
 
+	reasoning_apply_settings();
 	if (subscriptionId == reasoning_bootstraping_sub)
 	{
 		const char * pubAttributes[] = { "BTCN", "BTCNB" };
 		value_t pubValues[] = { values[0], values[2] };
 
-		
-
-		for (i = 0; i <  KNOWN_NODES_SIZE; i++) {
-			if ((known_nodes[i] >> 8) == values[0] &&
-			    (known_nodes[i] & 0xff) == values[1]) {
-				DEBUG("BOOTSTRAPING", LOG_INFO, "Node %u has already been registered with %u sensors\n", values[0], values[2]);
-				goto confirmation;
-			}
+		// values[0] : node ID, values[1] : area, values[2] : sensor count
+		// A node publishes again until it gets the confirmation, registering is idempotent
+		if (!known_nodes_register(values[0], values[2]))
+		{
+			DEBUG("BOOTSTRAPING", LOG_CRITICAL, "Known nodes table full (%u nodes), node %u is not registered\n",
+			      known_nodes_count, values[0]);
+			return 0;
 		}
-		for (i = 0; i <  KNOWN_NODES_SIZE; i++)
-			if (known_nodes[i] == 0)
-				break;
-		known_nodes[i] = (values[0] << 8) | (values[2] & 0xff);
-		DEBUG("BOOTSTRAPING", LOG_INFO, "Registering node with %d sensors (area = %u), adjusting the criticality threshold\n", values[1], values[2]);
 		compute_criticality_threshold();
-		DEBUG("BOOTSTRAPING", LOG_INFO, "Sending confirmation to node %u with %u sensors\n", values[0], values[2]);
-confirmation:
+		DEBUG("BOOTSTRAPING", LOG_INFO, "Node %u registered with %u sensors, %u sensors in %u nodes, sending confirmation\n",
+		      values[0], values[2], known_sensors, known_nodes_count);
 		Publish(pubAttributes, pubValues, 2, 0);
 		return 0;
 	}
@@ -365,16 +874,14 @@ confirmation:
 	}
 	else if (subscriptionId == failure_sub)
 	{
-		// remove the sensor node from the known_nodes table
-		for (i = 0; i <  KNOWN_NODES_SIZE; i++) {
-			if ((known_nodes[i] >> 8) == values[1]) {
-				DEBUG("BOOTSTRAPING", LOG_INFO,
-				      "Received a notification for the failure of node %d (%d sensors)\n",
-				       values[1], known_nodes[i] & 0xff);
-				known_nodes[i] = 0;
-				compute_criticality_threshold();
-				return 0;
-			}
+		// remove the sensor node from the known nodes
+		if (known_nodes_fail(values[1]))
+		{
+			compute_criticality_threshold();
+			DEBUG("BOOTSTRAPING", LOG_INFO,
+			      "Received a notification for the failure of node %d, %u sensors in %u nodes\n",
+			      values[1], known_sensors, known_nodes_count);
+			return 0;
 		}
 		DEBUG("BOOTSTRAPING", LOG_INFO,
 			"Received a notification for the failure of a unknown node %d\n",
@@ -387,7 +894,7 @@ confirmation:
 		{
 			if (subscriptionId == monitored_areas_subs[i])
 			{
-				area_add_event(i, values[0]);
+				area_add_summary(i, values);
 				return 0;
 			}
 		}
@@ -396,29 +903,61 @@ confirmation:
 		return 1;
 }
 
-void reasoning_emit_alarm(uint16_t criticality, timestamp_t timestamp, uint32_t involved_sensors)
+void reasoning_flush_alerts()
 {
-	const char * pubAttributes[] = { "AlmLvl", "AlmTsp", "AlmAr", "AlmLst", "AlmDrt" };
-	value_t pubValues[] = { criticality/100, timestamp, AREA_ID, involved_sensors, 0};
-	timestamp_t firstAlert = UINT32_MAX;
-	int i;
+	reasoning_apply_settings();
+	if (pending_alerts && time_get() - first_pending_alert >= alert_coalescing_window)
+		evaluate_pending_alerts();
+	alarm_session_update(time_get());
+#if AREA_SUMMARY_PERIOD
+	if (time_get() >= next_summary)
+		area_publish_summary(time_get());
+#endif
+}
 
-	reasoning_alarm_count++;
+portTickType reasoning_next_flush()
+{
+	portTickType next = alarm_session_next_update();
+
+	if (pending_alerts && time_before(first_pending_alert + alert_coalescing_window, next))
+		next = first_pending_alert + alert_coalescing_window;
+#if AREA_SUMMARY_PERIOD
+	// Nothing to summarize in a quiet area, the first alert wakes the node anyway
+	if ((summary_percent || criticality_acc.first_active != CRITICALITY_NONE) && time_before(next_summary, next))
+		next = next_summary;
+#endif
+	return next;
+}
 
-	for (i = 0; i < sensors_updates.size; i++) {
-		if (compute_linear_criticality(sensors_updates.sensors[i].time, get_max_intrusion_duration() * 2) == 0)
-			continue;
-		if (sensors_updates.sensors[i].time < firstAlert)
-			firstAlert = sensors_updates.sensors[i].time;
-	}
-	pubValues[4] = timestamp - firstAlert;
+void reasoning_emit_alarm(uint16_t criticality, timestamp_t timestamp, uint32_t involved_sensors)
+{
+	portTickType now = time_get();
 
-	DEBUG("REASONING", LOG_INFO, "Sending an alarm : criticality = %u, timestamp = %u, area = %u, nodelist = %u, duration = %u, ratio = %f (%u/%u)\n",
-	      criticality/100,
-	      timestamp, AREA_ID, involved_sensors, pubValues[4], (float)reasoning_alarm_count/reasoning_alert_count, reasoning_alarm_count, reasoning_alert_count);
+	// Closes the previous session if it is over
+	alarm_session_update(now);
+	if (!alarm_session.open)
+	{
+		alarm_session.open = true;
+		alarm_session.first_alert = first_active_alert(timestamp);
+		alarm_session.peak = criticality;
+		alarm_session.involved_sensors = involved_sensors;
+		alarm_session.last_alarm = timestamp;
+		alarm_session.alarms = 1;
+		DEBUG("REASONING", LOG_INFO, "Alarm session opened, first alert at %u\n", alarm_session.first_alert);
+		alarm_session_publish(now);
+		return;
+	}
 
-	
-	Publish(pubAttributes, pubValues, 5, 0);
+	alarm_session.alarms++;
+	alarm_session.last_alarm = timestamp;
+	if (criticality > alarm_session.peak)
+		alarm_session.peak = criticality;
+	alarm_session.involved_sensors |= involved_sensors;
+	if ((alarm_session.involved_sensors & ~alarm_session.published_sensors) ||
+	    alarm_session.peak > alarm_session.published_peak ||
+	    timestamp - alarm_session.last_publication >= get_max_intrusion_duration())
+		alarm_session.changed = true;
+	alarm_session_update(now);
 }
 #else /* Not a reasoning node */
 void
@@ -427,5 +966,9 @@ reasoning_init()
 	DEBUG("REASONING", LOG_DEBUG, "None\n");
 	min_intrusion_duration = MIN_INTRUSION_DURATION;
 	max_intrusion_duration = MAX_INTRUSION_DURATION;
+	alert_coalescing_window = ALERT_COALESCING_WINDOW;
+	new_min_intrusion_duration = 0;
+	new_max_intrusion_duration = 0;
+	new_history_analyze_period = 0;
 }
 #endif
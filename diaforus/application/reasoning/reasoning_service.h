@@ -28,9 +28,39 @@ void reasoning_init ();
 int reasoning_update(const char * const attributes[], const value_t values[], uint8_t subscriptionId);
 
 /**
- * \brief To be called when an *alarm* must be sent to the operator
+ * \brief To be called periodically (iterative_tasks), evaluates the alerts
+ * whose coalescing window has expired and publishes the area summary every
+ * AREA_SUMMARY_PERIOD
+ */
+void reasoning_flush_alerts ();
+
+/**
+ * \brief Get the time at which reasoning_flush_alerts() has alerts to evaluate,
+ * an alarm session to update or an area summary to publish
+ * \return the time, portMAX_DELAY when nothing is pending
+ */
+portTickType reasoning_next_flush ();
+
+/**
+ * \brief To be called periodically (iterative_tasks), notifies the CoAP
+ * observers when the criticality moved by CRITICALITY_NOTIFY_DELTA or when
+ * an alarm was emitted (reasoning_coap.c)
+ */
+void reasoning_coap_notify ();
+
+/**
+ * \brief Get the time at which reasoning_coap_notify() checks the criticality
+ * \return the time, portMAX_DELAY when nothing is observed
+ */
+portTickType reasoning_coap_next_notify ();
+
+/**
+ * \brief To be called when an *alarm* must be sent to the operator, it opens
+ * an alarm session or updates the current one, whose publications are rate
+ * limited (ALARM_BUCKET_SIZE)
  * \param criticality the criticality level of the alarm
  * \param timestamp the timestamp of the alarm
+ * \param involved_sensors bit field of the nodes involved in the alarm
  */
 void reasoning_emit_alarm(uint16_t criticality, timestamp_t timestamp, uint32_t involved_sensors);
 
@@ -103,12 +133,19 @@ int set_latency_mode(int mode);
  */
 uint32_t get_max_intrusion_duration();
 
+/**
+ * \brief Get the max intrusion duration set last, applied or not yet
+ * \return the duration in ms
+ */
+uint32_t get_max_intrusion_duration_setting();
+
 /**
  * \brief Set the duration corresponding
  *  to the intrusion duration for this node.
+ *  On a reasoning node, it is applied before the next evaluation.
  * \return an error code
  * \retval 0 if the value was correct and stored
- * \retval ERROR_VALUE if the value is not allowed
+ * \retval ERROR_VALUE if the value is 0 or below the min intrusion duration
  */
 int set_max_intrusion_duration(uint32_t duration);
 
@@ -119,13 +156,56 @@ int set_max_intrusion_duration(uint32_t duration);
  */
 uint32_t get_min_intrusion_duration();
 
+/**
+ * \brief Get the min intrusion duration set last, applied or not yet
+ * \return the duration in ms
+ */
+uint32_t get_min_intrusion_duration_setting();
+
 /**
  * \brief Set the duration corresponding
  *  to the intrusion duration for this node.
+ *  On a reasoning node, it is applied before the next evaluation.
  * \return an error code
  * \retval 0 if the value was correct and stored
- * \retval ERROR_VALUE if the value is not allowed
+ * \retval ERROR_VALUE if the value is 0 or above the max intrusion duration
  */
 int set_min_intrusion_duration(uint32_t duration);
 
+/**
+ * \brief Get the period after which a suspicious event leaves the history.
+ * \return the period in ms
+ */
+uint32_t get_history_analyze_period();
+
+/**
+ * \brief Get the history analyze period set last, applied or not yet
+ * \return the period in ms
+ */
+uint32_t get_history_analyze_period_setting();
+
+/**
+ * \brief Set the period after which a suspicious event leaves the history.
+ *  It is applied before the next evaluation.
+ * \return an error code
+ * \retval 0 if the value was correct and stored
+ * \retval ERROR_VALUE if the value is not allowed
+ */
+int set_history_analyze_period(uint32_t period);
+
+/**
+ * \brief Get the window during which the alerts are evaluated together.
+ * \return the window in ms, 0 when each alert is evaluated on arrival
+ */
+uint32_t get_alert_coalescing_window();
+
+/**
+ * \brief Set the window during which the alerts are evaluated together.
+ * The evaluation of an alert is delayed by at most this window, plus the
+ * period of iterative_tasks().
+ * \return an error code
+ * \retval 0 if the value was correct and stored
+ */
+int set_alert_coalescing_window(uint32_t window);
+
 #endif /* REASONING_SERVICE_H_ */
@@ -12,17 +12,12 @@
 
 #define CRITICALITY_VARIATION_TIME (get_min_intrusion_duration() / 10)
 
-typedef struct
-{
-	portTickType time; // 4 bytes
-	sensorid_t sensor_ID; // 2 bytes
-	uint8_t value; // 1 byte
-} sensor_update_t; // 7 bytes (needs to be packed)
-
-/// stores the state of sensors
+/// stores the state of sensors, one array per field so that 7 bytes are used per alert
 typedef struct 
 {
-	sensor_update_t sensors[ALERT_HISTORY_SIZE];
+	portTickType time[ALERT_HISTORY_SIZE];
+	sensorid_t sensor_ID[ALERT_HISTORY_SIZE];
+	uint8_t value[ALERT_HISTORY_SIZE];
 	uint8_t size;
 } sensors_update_t;
 
@@ -39,6 +34,10 @@ static inline uint8_t compute_linear_criticality(portTickType time, int global_d
 	return linear_time;
 }
 
+/* To be called when the reputation of a sensor changes, the criticality
+ accumulated for its alerts is recomputed */
+void reasoning_criticality_refresh();
+
 extern sensors_update_t sensors_updates;
 extern uint16_t reasoning_alarm_count, reasoning_alert_count;
 extern uint8_t sensor_count;
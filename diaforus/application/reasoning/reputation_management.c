@@ -7,98 +7,136 @@
 #include <assert.h>
 #include "reasoning_history_p.h"
 #include "reasoning_service.h"
+#include "reasoning_service_p.h"
 #include "reputation_management.h"
 
 #if IS_SIMU && ROLE_REASONING
 
-#define REPUTATION_TABLE_SIZE 16
+/* Sized by build_network.py from the sensors of the area */
+#ifndef REPUTATION_TABLE_BITS
+#define REPUTATION_TABLE_BITS 4
+#endif
+#define REPUTATION_TABLE_SIZE (1 << REPUTATION_TABLE_BITS)
+#define REPUTATION_NONE UINT8_MAX
 
-#warning "FIXME: Alignment"
-typedef struct
-{
-	uint8_t reputation;
-        bool tp_reported;
-        sensorid_t sensorid;
-        uint16_t tp; // correct contributions
-        uint16_t td; // total contributions
-        uint16_t alarm_contribution;
-} reputation_t;
+#if REPUTATION_TABLE_BITS > 7
+# error "REPUTATION_TABLE_BITS must be at most 7, the slots are indexed on 8 bits"
+#endif
 
-static reputation_t reputation_table[REPUTATION_TABLE_SIZE];
+/* The reputation deltas are fixed point numbers with 8 fractional bits */
+#define REPUTATION_DELTA_SHIFT 8
+typedef int32_t reputation_delta_t;
+
+/// Open addressed on the sensorid, slots are never freed. One array per field, the probes only read the sensorids
+static sensorid_t reputation_sensorid[REPUTATION_TABLE_SIZE];
+static uint8_t reputation_value[REPUTATION_TABLE_SIZE];
+static uint16_t reputation_tp[REPUTATION_TABLE_SIZE]; // correct contributions
+static uint16_t reputation_td[REPUTATION_TABLE_SIZE]; // total contributions
+static uint16_t reputation_alarm_contribution[REPUTATION_TABLE_SIZE];
+static uint8_t reputation_tp_reported[(REPUTATION_TABLE_SIZE + 7) / 8]; // bit field
 uint32_t reputation_alarm_count;
 
 static inline bool slot_is_empty(uint16_t slot)
 {
-	return (reputation_table[slot].sensorid == UINT8_MAX) && (reputation_table[slot].reputation == 0);
+	return (reputation_sensorid[slot] == UINT8_MAX) && (reputation_value[slot] == 0);
+}
+
+/* Fibonacci hashing, the node id and the modality/id bytes are mixed */
+static inline uint8_t reputation_table_hash(sensorid_t id)
+{
+	return (uint16_t)(id * 40503u) >> (16 - REPUTATION_TABLE_BITS);
 }
 
 static uint8_t sensor_contribution_index_lookup(sensorid_t sensorid, uint8_t header)
 {
 	uint8_t i;
-	for (i = 0; i < SENSOR_STATE_COUNT; i++)
+	for (i = sensor_state_first(header); i != SENSOR_STATE_NONE; i = sensor_state_next(i))
 	{
-		if ((sensor_state_table[i].sensorid == sensorid) && (sensor_state_table[i].header == header))
+		if (sensor_state_table[i].sensorid == sensorid)
 			return i;
 	}
 	return -1;
 }
 
+/* Returns the slot of id or the empty slot where it belongs, REPUTATION_NONE if the table is full */
+static uint8_t reputation_table_probe(sensorid_t id)
+{
+	uint8_t i, slot = reputation_table_hash(id);
+
+	for (i = 0; i < REPUTATION_TABLE_SIZE; i++, slot = (slot + 1) & (REPUTATION_TABLE_SIZE - 1))
+	{
+		if (reputation_sensorid[slot] == id || slot_is_empty(slot))
+			return slot;
+	}
+	return REPUTATION_NONE;
+}
+
 static uint8_t reputation_table_index_lookup (sensorid_t id)
 {
-	uint8_t i;
-	
-	// The slot is already reserved
-	for (i = 0; i < REPUTATION_TABLE_SIZE; i++)
+	uint8_t i = reputation_table_probe(id);
+
+	if (i == REPUTATION_NONE)
 	{
-		if (reputation_table[i].sensorid == id)
-			return i;
+		DEBUG("REASONING", LOG_CRITICAL, "REPUTATION MANAGEMENT: table full, %s-%u of NODE %u is ignored\n",
+		      modality_string(modality_from_sensor_id(id)), id_from_sensor_id(id), node_id_from_sensor_id(id));
+		return REPUTATION_NONE;
 	}
-	
-	// Find the first free slot
-	for (i = 0; i < REPUTATION_TABLE_SIZE; i++)
+
+	// Reserve the slot
+	if (slot_is_empty(i))
 	{
-		if (slot_is_empty(i))
-		{
-			reputation_table[i].sensorid = id;
-			reputation_table[i].reputation = 100;
-			return i;
-		}
+		reputation_sensorid[i] = id;
+		reputation_value[i] = 100;
 	}
+	return i;
 }
 
 static uint8_t sensor_update_true_positive(sensorid_t id)
 {
 	uint8_t i = reputation_table_index_lookup(id);
-	
-	reputation_table[i].tp++;
-	if (reputation_table[i].tp > reputation_table[i].td)
-	  reputation_table[i].tp = reputation_table[i].td;
+
+	if (i == REPUTATION_NONE)
+		return i;
+	reputation_tp[i]++;
+	if (reputation_tp[i] > reputation_td[i])
+	  reputation_tp[i] = reputation_td[i];
 	return i;
 }
 
-static void update_sensor_reputation(uint8_t index, float delta, uint16_t threshold_percent)
+/* Scales the reputation of the sensor by (alert_level + delta) / alert_level, alert_level
+ being the part of the threshold the sensor contributed to */
+static void update_sensor_reputation(uint8_t index, reputation_delta_t delta, uint16_t threshold_percent)
 {
 	uint8_t i;
 	uint8_t contribution;
+	int32_t alert_level, reputation;
 	sensorid_t sensor_ID;
 
 	i = reputation_table_index_lookup(sensor_state_table[index].sensorid);
+	if (i == REPUTATION_NONE)
+		return;
 	contribution = sensor_state_table[index].contribution * 100 / 15;
 
 	sensor_ID = sensor_state_table[index].sensorid;
-	float alert_level = get_criticality_threshold() * contribution / 100;
-	uint8_t valPerDec = alert_level / (reputation_table[i].reputation / 100);
-	uint8_t old_reputation = reputation_table[i].reputation;
+	alert_level = (get_criticality_threshold() * contribution / 100) << REPUTATION_DELTA_SHIFT;
+	if (alert_level == 0)
+		return;
+	uint8_t old_reputation = reputation_value[i];
 
-	float new_alert_level = alert_level + delta;
+	reputation = (int64_t) old_reputation * (alert_level + delta) / alert_level;
+	if (reputation < 0)
+		reputation = 0;
+	if (reputation > UINT8_MAX)
+		reputation = UINT8_MAX;
 
-	reputation_table[i].reputation = new_alert_level / valPerDec * 100;
+	reputation_value[i] = reputation;
+	reasoning_criticality_refresh();
 	DEBUG("REASONING", LOG_CRITICAL, "REPUTATION MANAGEMENT: %s-%d : Adjusting reputation from %u to %u\n",
 	      modality_string(modality_from_sensor_id(sensor_ID)), id_from_sensor_id(sensor_ID), old_reputation,
-		reputation_table[i].reputation);
+		reputation_value[i]);
 }
 
-float compute_sensor_delta(float alarm_delta, uint8_t contribution)
+static reputation_delta_t compute_sensor_delta(reputation_delta_t alarm_delta, uint8_t contribution)
 {
 	uint8_t contrib_percent = contribution * 100/15;
 	return (alarm_delta * contrib_percent / 100);
@@ -109,7 +147,7 @@ void reputation_management_report_false_positive(timestamp_t timestamp, uint8_t
 
 	uint8_t i = 0, header = 0;
 	uint16_t percent = 0;
-	float global_delta = 0;
+	reputation_delta_t global_delta = 0;
 	
 	if ((critical_level & 0x1) == 0)
 		return;
@@ -127,20 +165,19 @@ void reputation_management_report_false_positive(timestamp_t timestamp, uint8_t
 	  percent++;
 	percent = (percent * 100 / 32) + 100;
 	
-	global_delta = (get_criticality_threshold() * percent/100.0) - (get_criticality_threshold() * 0.95);
+	global_delta = (int64_t) get_criticality_threshold() * ((int16_t) percent - 95) * (1 << REPUTATION_DELTA_SHIFT) / 100;
 
 	DEBUG("REASONING", LOG_CRITICAL, "REPUTATION MANAGEMENT: Match found with event header = %u "
-	      "timestamp = %u, critical_level = %u :  global_delta = %f\n", header, timestamp, critical_level, global_delta);
+	      "timestamp = %u, critical_level = %u :  global_delta = %d/256\n", header, timestamp, critical_level, global_delta);
 	
 	// Find all sensors attached to this event
-	for (i = 0; i < SENSOR_STATE_COUNT; i++)
+	for (i = sensor_state_first(header); i != SENSOR_STATE_NONE; i = sensor_state_next(i))
 	{
-		if (sensor_state_table[i].header == header && 
-		sensor_state_table[i].contribution != 0)
+		if (sensor_state_table[i].contribution != 0)
 		{
-		         float sensor_delta = compute_sensor_delta(global_delta, sensor_state_table[i].contribution);
+		         reputation_delta_t sensor_delta = compute_sensor_delta(global_delta, sensor_state_table[i].contribution);
 			 DEBUG("REASONING", LOG_CRITICAL, "REPUTATION MANAGEMENT: %s-%u: "
-			" got a contribution of %u, delta=%f\n", 	modality_string( modality_from_sensor_id(sensor_state_table[i].sensorid) ),
+			" got a contribution of %u, delta=%d/256\n", 	modality_string( modality_from_sensor_id(sensor_state_table[i].sensorid) ),
 			       id_from_sensor_id(sensor_state_table[i].sensorid), sensor_state_table[i].contribution, sensor_delta);
 			update_sensor_reputation(i, - sensor_delta, percent);
 		}
@@ -152,7 +189,7 @@ void reputation_management_report_false_negative(timestamp_t timestamp)
 {
 	uint8_t i = 0, header = 0, critical_level = 0;
 	uint8_t percent;
-	float global_delta;
+	reputation_delta_t global_delta;
 
 	header = reasoning_history_find_nearest_event(timestamp);
 	critical_level = reasoning_history_get_event_critical_level(header);
@@ -161,33 +198,42 @@ void reputation_management_report_false_negative(timestamp_t timestamp)
 		return;
 	timestamp = reasoning_history_get_event_timestamp(header);
 	percent = critical_level >> 1;
-	global_delta = (get_criticality_threshold() * 1.1) - (get_criticality_threshold() * percent / 100);
+	global_delta = ((int64_t) get_criticality_threshold() * 110 << REPUTATION_DELTA_SHIFT) / 100
+		- ((get_criticality_threshold() * percent / 100) << REPUTATION_DELTA_SHIFT);
 	
 	DEBUG("REASONING", LOG_CRITICAL, "REPUTATION MANAGEMENT: False negative reported for "
-	      "event with critical_level = %u, timestamp = %u : global_delta = %f\n", critical_level, timestamp, global_delta);
+	      "event with critical_level = %u, timestamp = %u : global_delta = %d/256\n", critical_level, timestamp, global_delta);
 
 	// Find all sensors attached to this event
-	for (i = 0; i < SENSOR_STATE_COUNT; i++)
+	for (i = sensor_state_first(header); i != SENSOR_STATE_NONE; i = sensor_state_next(i))
 	{
-		if (sensor_state_table[i].header == header && 
-		sensor_state_table[i].contribution != 0)
+		if (sensor_state_table[i].contribution != 0)
 		{
-			float sensor_delta = compute_sensor_delta(global_delta,
+			reputation_delta_t sensor_delta = compute_sensor_delta(global_delta,
 				sensor_state_table[i].contribution);
 			DEBUG("REASONING", LOG_CRITICAL, "REPUTATION MANAGEMENT: %s-%u: "
-			" got a contribution of %u, delta=%f\n", 	modality_string( modality_from_sensor_id(sensor_state_table[i].sensorid) ),
+			" got a contribution of %u, delta=%d/256\n", 	modality_string( modality_from_sensor_id(sensor_state_table[i].sensorid) ),
 			       id_from_sensor_id(sensor_state_table[i].sensorid), sensor_state_table[i].contribution, sensor_delta);
 			update_sensor_reputation(i, sensor_delta, percent);
 		}
 	}
 }
 
+/* Percentage of correct contributions minus the share of the alarms the sensor contributed to */
+static int16_t reputation_ratio(uint8_t id)
+{
+	uint32_t alarms = reputation_alarm_count ? reputation_alarm_count : 1;
+
+	return (int32_t) reputation_tp[id] * 100 / reputation_td[id]
+		- (int32_t) (reputation_alarm_contribution[id] * 100 / alarms);
+}
+
 void reputation_management_auto_adjust(uint8_t alert_index)
 {
         sensorid_t sensorid;
 	uint8_t alarms;
 	uint16_t i, j, id;
-	float ratio;
+	int16_t ratio;
 
 	sensorid = reasoning_history_alert_sensorid(alert_index);
 	alarms = reasoning_history_alert_involved_in_alarms(alert_index);
@@ -195,29 +241,16 @@ void reputation_management_auto_adjust(uint8_t alert_index)
 	PRINTF("REPUTATION MANAGEMENT: automatic adjustment for alert index %u sensorid: NODE %u %s-%u, involved in alarms: %s\n", alert_index, node_id_from_sensor_id(sensorid), modality_string(modality_from_sensor_id(sensorid)),
 	       id_from_sensor_id(sensorid), alarms ? "TRUE" : "FALSE");
 
+	reputation_management_update_total_detection(sensorid);
 	if (alarms)
-	{
-		reputation_management_update_total_detection(sensorid);
 		id = sensor_update_true_positive(sensorid);
-		if (reputation_alarm_count)
-		  ratio = 100 * ( (float)reputation_table[id].tp / reputation_table[id].td - (float)reputation_table[id].alarm_contribution / reputation_alarm_count );
-		else
-		  ratio = 100 * ( (float)reputation_table[id].tp / reputation_table[id].td - (float)reputation_table[id].alarm_contribution);
-
-		PRINTF("REPUTATION MANAGEMENT: ratio=%f (%u/%u - %u/%u)\n", ratio, reputation_table[id].tp, reputation_table[id].td, reputation_table[id].alarm_contribution, reputation_alarm_count);
-	}
 	else
-	{
-		reputation_management_update_total_detection(sensorid);
 		id = reputation_table_index_lookup(sensorid);
-		if (reputation_alarm_count)
-		  ratio = 100 * ( (float)reputation_table[id].tp / reputation_table[id].td - (float)reputation_table[id].alarm_contribution / reputation_alarm_count );
-		else
-		  ratio = 100 * ( (float)reputation_table[id].tp / reputation_table[id].td - (float)reputation_table[id].alarm_contribution);
-
+	if (id == REPUTATION_NONE)
+		return;
 
-		PRINTF("REPUTATION MANAGEMENT: ratio=%f (%u/%u - %u/%u)\n", ratio, reputation_table[id].tp, reputation_table[id].td, reputation_table[id].alarm_contribution, reputation_alarm_count);
-	}
+	ratio = reputation_ratio(id);
+	PRINTF("REPUTATION MANAGEMENT: ratio=%d (%u/%u - %u/%u)\n", ratio, reputation_tp[id], reputation_td[id], reputation_alarm_contribution[id], reputation_alarm_count);
 	
 	/*
 	// True positive
@@ -231,11 +264,11 @@ void reputation_management_auto_adjust(uint8_t alert_index)
 			{
 			        reputation_management_update_total_detection(reasoning_history_alert_sensorid(i));
 				id = sensor_update_true_positive(reasoning_history_alert_sensorid(i));
-				ratio = (float)reputation_table[id].tp / reputation_table[id].td;
+				ratio = (float)reputation_tp[id] / reputation_td[id];
 
 				PRINTF("REPUTATION MANAGEMENT: NODE %u %s-%u: "
 				       " ratio=%f (%u/%u) (correlated)\n",  node_id_from_sensor_id(reasoning_history_alert_sensorid(i)), modality_string( modality_from_sensor_id(reasoning_history_alert_sensorid(i)) ),
-				       id_from_sensor_id(reasoning_history_alert_sensorid(i)), ratio, reputation_table[id].tp, reputation_table[id].td);
+				       id_from_sensor_id(reasoning_history_alert_sensorid(i)), ratio, reputation_tp[id], reputation_td[id]);
 			}
 		}
 		
@@ -244,18 +277,18 @@ void reputation_management_auto_adjust(uint8_t alert_index)
 		{
 			if (slot_is_empty(i))
 				continue;
-			j = sensor_contribution_index_lookup(reputation_table[i].sensorid, header);
+			j = sensor_contribution_index_lookup(reputation_sensorid[i], header);
 			// The sensor is not found in the contributions table for this event,
 			// so it's not correlated
 			if (j == UINT8_MAX)
 			  {
-			    reputation_management_update_total_detection(reputation_table[i].sensorid);
-			    id = reputation_table_index_lookup(reputation_table[i].sensorid);
-			    ratio = (float)reputation_table[id].tp / reputation_table[id].td;
+			    reputation_management_update_total_detection(reputation_sensorid[i]);
+			    id = reputation_table_index_lookup(reputation_sensorid[i]);
+			    ratio = (float)reputation_tp[id] / reputation_td[id];
 
 			    PRINTF("REPUTATION MANAGEMENT: NODE %u %s-%u: "
-				   " ratio=%f (%u/%u) (non-correlated)\n", node_id_from_sensor_id(reputation_table[i].sensorid), modality_string( modality_from_sensor_id(reputation_table[i].sensorid) ),
-				   id_from_sensor_id(reputation_table[i].sensorid), ratio, reputation_table[id].tp, reputation_table[id].td);
+				   " ratio=%f (%u/%u) (non-correlated)\n", node_id_from_sensor_id(reputation_sensorid[i]), modality_string( modality_from_sensor_id(reputation_sensorid[i]) ),
+				   id_from_sensor_id(reputation_sensorid[i]), ratio, reputation_tp[id], reputation_td[id]);
 			    
 			  }
 			
@@ -272,11 +305,11 @@ void reputation_management_auto_adjust(uint8_t alert_index)
 			{
 			        reputation_management_update_total_detection(reasoning_history_alert_sensorid(i));
 				id = reputation_table_index_lookup(reasoning_history_alert_sensorid(i));
-				ratio = (float)reputation_table[id].tp / reputation_table[id].td;
+				ratio = (float)reputation_tp[id] / reputation_td[id];
 
 				PRINTF("REPUTATION MANAGEMENT: NODE %u %s-%u: "
 				       " ratio=%f (%u/%u) (correlated)\n",  node_id_from_sensor_id(reasoning_history_alert_sensorid(i)), modality_string( modality_from_sensor_id(reasoning_history_alert_sensorid(i)) ),
-				       id_from_sensor_id(reasoning_history_alert_sensorid(i)), ratio, reputation_table[id].tp, reputation_table[id].td);
+				       id_from_sensor_id(reasoning_history_alert_sensorid(i)), ratio, reputation_tp[id], reputation_td[id]);
 			}
 		}
 	}
@@ -285,11 +318,11 @@ void reputation_management_auto_adjust(uint8_t alert_index)
 
 uint8_t reputation_management_get_sensor_reputation(sensorid_t id)
 {
-	uint8_t i;
-	for (i = 0; i < REPUTATION_TABLE_SIZE; i++)
-		if (reputation_table[i].sensorid == id)
-			return reputation_table[i].reputation;
-	return 100;
+	uint8_t i = reputation_table_probe(id);
+
+	if (i == REPUTATION_NONE || slot_is_empty(i))
+		return 100;
+	return reputation_value[i];
 }
 
 void reputation_management_update_total_detection(sensorid_t id)
@@ -297,12 +330,14 @@ void reputation_management_update_total_detection(sensorid_t id)
 	uint8_t i;
 
 	i = reputation_table_index_lookup(id);
+	if (i == REPUTATION_NONE)
+		return;
 
-	reputation_table[i].td++;
-	if (reputation_table[i].td >= 1000)
+	reputation_td[i]++;
+	if (reputation_td[i] >= 1000)
 	{
-		reputation_table[i].td /= 2;
-		reputation_table[i].tp /= 2;
+		reputation_td[i] /= 2;
+		reputation_tp[i] /= 2;
 	}
 }
 
@@ -311,23 +346,29 @@ void reputation_management_update_alarm_contribution(sensorid_t id)
   uint8_t i;
 
   i = reputation_table_index_lookup(id);
-  reputation_table[i].alarm_contribution++;
+  if (i != REPUTATION_NONE)
+    reputation_alarm_contribution[i]++;
 }
 
 void reputation_management_undo_tp(sensorid_t id)
 {
     uint8_t i;
     i = reputation_table_index_lookup(id);
-    reputation_table[i].tp_reported = false;
+    if (i != REPUTATION_NONE)
+      reputation_tp_reported[i / 8] &= ~(1 << (i % 8));
 }
 
 void reputation_management_init()
 {
         int i;
 
-	memset(reputation_table, 0, REPUTATION_TABLE_SIZE * sizeof(reputation_t));
+	memset(reputation_value, 0, sizeof(reputation_value));
+	memset(reputation_tp, 0, sizeof(reputation_tp));
+	memset(reputation_td, 0, sizeof(reputation_td));
+	memset(reputation_alarm_contribution, 0, sizeof(reputation_alarm_contribution));
+	memset(reputation_tp_reported, 0, sizeof(reputation_tp_reported));
 	for (i = 0; i <  REPUTATION_TABLE_SIZE; i++)
-	    reputation_table[i].sensorid = UINT8_MAX;
+	    reputation_sensorid[i] = UINT8_MAX;
 	reputation_alarm_count = 0;
 }
 #endif
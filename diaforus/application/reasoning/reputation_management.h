@@ -20,6 +20,8 @@ uint8_t reputation_management_get_sensor_reputation(sensorid_t id);
 
 void reputation_management_update_total_detection(sensorid_t id);
 
+void reputation_management_update_alarm_contribution(sensorid_t id);
+
 void reputation_management_undo_tp(sensorid_t id);
 
 void reputation_management_init();
@@ -0,0 +1,123 @@
+#include "sensor_events.h"
+#include "sensors_drivers.h"
+
+static sensor_event_t ring[SENSOR_EVENT_RING_SIZE] __attribute__ (( section (".slowdata") ));
+/* head is only written by the producer, tail by the consumer, both count modulo 256 */
+static volatile uint8_t ring_head, ring_tail;
+static volatile uint16_t ring_dropped;
+
+/* The event must be written before the index which publishes it, and read before the one which frees it */
+#define sensor_events_barrier() __asm__ __volatile__ ("" ::: "memory")
+
+void sensor_events_init()
+{
+	ring_head = 0;
+	ring_tail = 0;
+	ring_dropped = 0;
+}
+
+bool sensor_events_push(uint8_t sensor, uint8_t level, portTickType time)
+{
+	uint8_t head = ring_head;
+
+	if ((uint8_t)(head - ring_tail) == SENSOR_EVENT_RING_SIZE)
+	{
+		ring_dropped++;
+		return false;
+	}
+	ring[head % SENSOR_EVENT_RING_SIZE].time = time;
+	ring[head % SENSOR_EVENT_RING_SIZE].sensor = sensor;
+	ring[head % SENSOR_EVENT_RING_SIZE].level = level;
+	sensor_events_barrier();
+	ring_head = head + 1;
+	return true;
+}
+
+bool sensor_events_pop(sensor_event_t *event)
+{
+	uint8_t tail = ring_tail;
+
+	if (tail == ring_head)
+		return false;
+	sensor_events_barrier();
+	*event = ring[tail % SENSOR_EVENT_RING_SIZE];
+	sensor_events_barrier();
+	ring_tail = tail + 1;
+	return true;
+}
+
+bool sensor_events_pending()
+{
+	return ring_tail != ring_head;
+}
+
+uint16_t sensor_events_dropped()
+{
+	return ring_dropped;
+}
+
+#if SENSOR_EVENT_DRIVEN
+
+/*
+ * Writes the periods ended since the previous write, the first one holding
+ * the rising edge latched during it. A poll also closes the current period.
+ */
+static uint8_t sensor_events_sync(sensor_t *sensor, portTickType now, bool poll)
+{
+	uint16_t period = sensor->periodicity ? sensor->periodicity : 1;
+	int32_t elapsed = now - sensor->history_time;
+	uint32_t periods = (elapsed > 0) ? elapsed / period : 0;
+	uint8_t value;
+
+	if (poll && periods == 0)
+		periods = 1;
+	if (periods == 0)
+		return sensor->level;
+
+	sensor->history_time = poll ? now : sensor->history_time + periods * period;
+	value = sensor_history_add(&sensor->history, sensor->level | sensor->latched);
+	sensor->latched = false;
+	if (periods > 1)
+	{
+		/* Older samples would be overwritten anyway */
+		if (periods > SENSOR_HISTORY_SPAN_MAX)
+			periods = SENSOR_HISTORY_SPAN_MAX + 1;
+		sensor_history_add_run(&sensor->history, sensor->level, periods - 1);
+		value = sensor->level;
+	}
+	return value;
+}
+
+void sensor_events_attach(sensor_t *sensor)
+{
+	sensor->history_time = time_get();
+	sensor->level = 0;
+	sensor->latched = false;
+}
+
+bool sensor_events_apply(sensor_t *sensor, const sensor_event_t *event)
+{
+	bool rising = event->level && !sensor->level;
+
+	sensor_events_sync(sensor, event->time, false);
+	if (rising)
+		sensor->latched = true;
+	sensor->level = event->level ? 1 : 0;
+
+	DEBUG("APP", LOG_DEBUG, "%s-%i: edge to %u at %u\n", modality_string(sensor->modality),
+	      sensor->id, sensor->level, event->time);
+	return rising;
+}
+
+value_t sensor_poll_edges(sensor_t *sensor)
+{
+	value_t value = sensor_events_sync(sensor, time_get(), true);
+
+	sensor->last_value = value;
+	/* Nothing to report until the next rising edge */
+	if (sensor_events_idle(sensor))
+		sensor->next_read = portMAX_DELAY;
+	return value;
+}
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef SENSOR_EVENTS_H_
+#define SENSOR_EVENTS_H_
+
+#include "pubsub_common.h"
+#include "reasoning_config.h"
+#include "sensors.h"
+
+/*
+ * Edges of the digital sensors (SENSOR_EVENT_DRIVEN). The simulated sensors
+ * timestamp the new level of a sensor into a single producer / single
+ * consumer ring, iterative_tasks() drains it. The history of such a sensor
+ * is only written when its level changes or when it is polled, one sample
+ * per period elapsed since the previous write.
+ */
+
+#if SENSOR_EVENT_DRIVEN && !IS_SIMU
+/* Nothing feeds the ring from the GPIO and MCP23018 interrupts yet: the idle sensors would never be polled again */
+#error "SENSOR_EVENT_DRIVEN is only supported by the simulation"
+#endif
+
+#define SENSOR_EVENT_RING_SIZE 16
+
+#if SENSOR_EVENT_RING_SIZE & (SENSOR_EVENT_RING_SIZE - 1) || SENSOR_EVENT_RING_SIZE > 128
+#error "SENSOR_EVENT_RING_SIZE must be a power of two <= 128"
+#endif
+
+typedef struct
+{
+	portTickType time;
+	uint8_t sensor; // index in sensors[]
+	uint8_t level;
+} sensor_event_t;
+
+void sensor_events_init();
+
+/* Producer side, interrupt context: false when the ring is full and the edge is lost */
+bool sensor_events_push(uint8_t sensor, uint8_t level, portTickType time);
+
+/* Consumer side: false when the ring is empty */
+bool sensor_events_pop(sensor_event_t *event);
+
+/* Whether edges wait to be popped */
+bool sensor_events_pending();
+
+/* Edges lost since sensor_events_init() */
+uint16_t sensor_events_dropped();
+
+#if SENSOR_EVENT_DRIVEN
+/* Starts following the edges of the sensor, its level being 0 */
+void sensor_events_attach(sensor_t *sensor);
+
+/* Records the edge, returns true on a rising one */
+bool sensor_events_apply(sensor_t *sensor, const sensor_event_t *event);
+
+/* Poll of the edge driven sensors: the level since the previous poll */
+value_t sensor_poll_edges(sensor_t *sensor);
+
+/* Whether the sensor can be left alone until its next edge */
+static inline bool sensor_events_idle(sensor_t *sensor)
+{
+	return sensor->level == 0 && !sensor->latched;
+}
+
+static inline bool sensor_events_attached(sensor_t *sensor)
+{
+	return sensor->ops->poll == sensor_poll_edges;
+}
+#endif
+
+#endif /* SENSOR_EVENTS_H_ */
@@ -5,80 +5,84 @@
 // #include <math.h>
 
 
+#if !IS_SIMU && SENSOR_SPIRIT_BEAM_COUNT > 1
+#error "The SPIRIT driver reads a single beam, SENSOR_SPIRIT_BEAM_COUNT > 1 is only simulated"
+#endif
+
+#if (SENSOR_HISTORY_SIZE * 8) % SENSOR_SPIRIT_BEAM_WIDTH
+#error "The sensor history must hold a whole number of SPIRIT samples"
+#endif
+
 value_t sensor_poll_spirit(sensor_t *sensor)
 {
+	uint16_t beams;
 	
 #if (IS_SIMU)
 	uint8_t i;
-	int value;
+
+	beams = sensors_drivers_read_value(sensor) ? SENSOR_SPIRIT_BEAM_MASK : 0;
 	for (i = 0; i < SENSOR_SPIRIT_BEAM_COUNT; i++)
 	{
-		value = sensors_drivers_read_value(sensor);
 		if (sensor->stimulus[i] != UINT8_MAX)
 		{
-			value = sensor->stimulus[i] & 0x1;
+			beams &= ~(1 << i);
+			beams |= (sensor->stimulus[i] & 0x1) << i;
 			sensor->stimulus[i] = UINT8_MAX;
 		}
-		sensor_history_add(&sensor->history, value);
 	}
 #else
-	uint8_t value = (uint8_t) sensors_drivers_read_value(sensor);
-	sensor_history_add(&sensor->history, value);
-	sensor->last_value = value;
+	/* The driver only reports whether one of the beams is cut */
+	beams = sensors_drivers_read_value(sensor) ? 0x1 : 0;
 #endif
+	sensor_history_add_sample(&sensor->history, beams, SENSOR_SPIRIT_BEAM_WIDTH);
+	sensor->last_value = beams ? 1 : 0;
 	
 	return 0;
 }
 
 bool sensor_criticality_spirit(sensor_t* sensor)
 {
-	uint8_t i, value;
+	uint8_t value;
+	uint16_t beams = sensor_history_last_bits(&sensor->history, SENSOR_SPIRIT_BEAM_WIDTH);
 
 	/* Nothing happened recently, we restart the value exported to the reasoning node */
 	if (sensor_can_emit_alert(sensor))
 	{
-		for (i = 0; i < SENSOR_SPIRIT_BEAM_COUNT; i++)
+		/* Beam values are 0 or 1: one of them reaches the threshold iff the highest does */
+		value = beams ? 1 : 0;
+
+		if (value >= sensor->abs_threshold)
 		{
-			value = sensor_history_value(&sensor->history, i);
-
-			if (value >= sensor->abs_threshold)
-			{
-				DEBUG("APP", LOG_DEBUG, "%s-%i: Absolute alert: threshold=%i, alert_delta=%ims\n",
-					modality_string(sensor->modality), sensor->id,
-					sensor->abs_threshold, time_get() - sensor->last_alert);
-
-				sensor->last_alert = time_get();
-				sensor->normalized_value = 1;
-				sensor->old_variation = 6;
-				return true;
-			}
+			DEBUG("APP", LOG_DEBUG, "%s-%i: Absolute alert: threshold=%i, beams=%x, alert_delta=%ims\n",
+				modality_string(sensor->modality), sensor->id,
+				sensor->abs_threshold, beams, time_get() - sensor->last_alert);
+
+			sensor->last_alert = time_get();
+			sensor->normalized_value = 1;
+			sensor->old_variation = 6;
+			return true;
 		}
 	}
 
 	/* Fast variations monitoring */
-	value = 0;
-	for (i = 0; i < SENSOR_SPIRIT_BEAM_COUNT; i++)
-		value += sensor_history_value(&sensor->history, i);
+	value = __builtin_popcount(beams);
 
 	portTickType diffTime = time_get() - sensor->last_alert;
 
 	if ((value >= sensor->abs_threshold) && (diffTime >= CRITICALITY_VARIATION_TIME))
 	{
-		uint16_t polled_reads = (diffTime / sensor->periodicity);
-		uint16_t i = 0, j = 0, tmp = 0, sum = 0;
-		
-		for (i = 0; i < polled_reads; i++)
-		{
-			tmp = 0;
-			for (j = 0; j < SENSOR_SPIRIT_BEAM_COUNT; j++)
-			{
-				uint8_t v = sensor_history_value(&sensor->history, (i * SENSOR_SPIRIT_BEAM_COUNT) + j);
-				tmp += v;
-			}
-			sum += tmp;
-		}
+		uint32_t polled_reads = (diffTime / sensor->periodicity);
+		uint32_t tmp = 0, sum = 0, window = diffTime;
+
+		/* A sample of SENSOR_SPIRIT_BEAM_WIDTH values per poll, the ones older than the history count as 0 */
+		if (window > UINT32_MAX / SENSOR_SPIRIT_BEAM_WIDTH)
+			window = UINT32_MAX / SENSOR_SPIRIT_BEAM_WIDTH;
+		sum = sensor_history_count_ones_within(&sensor->history, window * SENSOR_SPIRIT_BEAM_WIDTH, sensor->periodicity);
 
-		tmp = (sum * 100) / (SENSOR_SPIRIT_BEAM_COUNT * polled_reads);
+		/* Not a whole period since the last alert, nothing to average yet */
+		if (polled_reads == 0)
+			return false;
+		tmp = (sum * 100) / (SENSOR_SPIRIT_BEAM_WIDTH * polled_reads);
 		
 	        DEBUG("APP", LOG_DEBUG, "%s-%i: Relative variation:  average=%u percent (sum=%u, polled_reads=%u), alert_delta=%ims\n",
 		       modality_string(sensor->modality), sensor->id, tmp, sum, polled_reads, diffTime);
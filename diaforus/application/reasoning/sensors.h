@@ -5,7 +5,42 @@
 #include "pubsub_common.h"
 #include "history.h"
 
+/*
+ * Overridden by reasoning_config.h when the barrier has several beams. Only
+ * the simulation reads them one by one, the driver of the boards reports
+ * whether one of them is cut, so real nodes keep a single beam.
+ */
+#ifndef SENSOR_SPIRIT_BEAM_COUNT
 #define SENSOR_SPIRIT_BEAM_COUNT 1
+#endif
+
+/*
+ * Each SPIRIT poll stores the value of every beam side by side in one sample
+ * of the history, beam i being bit i. Samples are rounded up to a power of two
+ * so that they stay aligned in the history bytes.
+ */
+#if SENSOR_SPIRIT_BEAM_COUNT < 1 || SENSOR_SPIRIT_BEAM_COUNT > 16
+#error "SENSOR_SPIRIT_BEAM_COUNT must be between 1 and 16"
+#elif SENSOR_SPIRIT_BEAM_COUNT == 1
+#define SENSOR_SPIRIT_BEAM_WIDTH 1
+#elif SENSOR_SPIRIT_BEAM_COUNT == 2
+#define SENSOR_SPIRIT_BEAM_WIDTH 2
+#elif SENSOR_SPIRIT_BEAM_COUNT <= 4
+#define SENSOR_SPIRIT_BEAM_WIDTH 4
+#elif SENSOR_SPIRIT_BEAM_COUNT <= 8
+#define SENSOR_SPIRIT_BEAM_WIDTH 8
+#else
+#define SENSOR_SPIRIT_BEAM_WIDTH 16
+#endif
+#define SENSOR_SPIRIT_BEAM_MASK ((uint16_t) ((1UL << SENSOR_SPIRIT_BEAM_COUNT) - 1))
+
+/*
+ * Set by reasoning_config.h when the digital sensors report their edges from
+ * interrupts (sensor_events.h) instead of being read on each poll
+ */
+#ifndef SENSOR_EVENT_DRIVEN
+#define SENSOR_EVENT_DRIVEN 0
+#endif
 
 extern uint32_t get_min_intrusion_duration();
 typedef uint16_t sensorid_t;
@@ -63,7 +98,17 @@ struct calibration_analog_t
 	int8_t div;
 };
 
+typedef struct sensor sensor_t;
+
+/// Driver of a modality, resolved for each sensor by sensors_drivers_init()
 typedef struct
+{
+	value_t (*poll)(sensor_t *sensor);
+	bool (*criticality)(sensor_t *sensor);
+	value_t (*calibrate)(sensor_t *sensor, value_t value);
+} sensor_ops_t;
+
+struct sensor
 {
 	/* characteristics */
 	modality_t modality;
@@ -90,6 +135,12 @@ typedef struct
 	value_t stimulus[SENSOR_SPIRIT_BEAM_COUNT];
 	history_t history;
 	value_t last_value;
+#if SENSOR_EVENT_DRIVEN
+	/* edges */
+	portTickType history_time; // the history holds the periods ended before
+	uint8_t level;
+	bool latched; // the level was set during the current period
+#endif
 
 	/* alerts */
 	value_t abs_threshold;
@@ -104,7 +155,10 @@ typedef struct
 		sensor_seismic_priv_t seismic_priv;
 		sensor_pir_priv_t pir_priv;
 	};
-} sensor_t;
+
+	/* driver */
+	const sensor_ops_t *ops;
+};
 
 static inline const char* modality_string(modality_t modality)
 {
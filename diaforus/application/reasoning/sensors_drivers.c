@@ -1,5 +1,6 @@
 #include "reasoning_service.h"
 #include "sensors_drivers.h"
+#include "sensor_events.h"
 #include "application_config.h"
 
 #include "hw_modality.h"
@@ -25,15 +26,53 @@
 #endif
 
 
+static value_t sensor_poll_none(sensor_t *sensor __attribute__ ((unused)))
+{
+	return 0;
+}
+
+static bool sensor_criticality_none(sensor_t *sensor __attribute__ ((unused)))
+{
+	return false;
+}
+
+static value_t sensor_calibration_none(sensor_t *sensor __attribute__ ((unused)), value_t value)
+{
+	return value;
+}
+
+/* Sensors of an unknown modality are polled but never alert */
+static const sensor_ops_t sensor_none_ops = {
+	.poll = sensor_poll_none,
+	.criticality = sensor_criticality_none,
+	.calibrate = sensor_calibration_none,
+};
 
 void sensors_drivers_init(sensor_t sensors[], size_t len)
 {
 	int i;
 	sensor_t *s;
+
 	for (i = 0; i < len; i++)
 	{
 		s = &sensors[i];
 
+#if SENSOR_EVENT_DRIVEN
+		if (s->modality >= 0 && s->modality < NUMBER_OF_MODALITIES && sensor_modality_edge_ops[s->modality].poll)
+		{
+			s->ops = &sensor_modality_edge_ops[s->modality];
+			sensor_events_attach(s);
+		}
+		else
+#endif
+		if (s->modality >= 0 && s->modality < NUMBER_OF_MODALITIES && sensor_modality_ops[s->modality].poll)
+			s->ops = &sensor_modality_ops[s->modality];
+		else
+		{
+			DEBUG("APP", LOG_CRITICAL, "%s-%u: no driver for this modality\n", modality_string(s->modality), s->id);
+			s->ops = &sensor_none_ops;
+		}
+
 		switch (s->connection)
 		{
 		case CONNECT_GPIO:
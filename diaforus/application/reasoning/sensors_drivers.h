@@ -4,9 +4,23 @@
 #include "reasoning_common.h"
 #include "sensors.h"
 
+/* Drivers of the modalities, indexed by modality_t (user_application.c) */
+extern const sensor_ops_t sensor_modality_ops[NUMBER_OF_MODALITIES];
+#if SENSOR_EVENT_DRIVEN
+/* The same, for the modalities whose sensors report their edges */
+extern const sensor_ops_t sensor_modality_edge_ops[NUMBER_OF_MODALITIES];
+#endif
+
 void sensors_drivers_init(sensor_t sensors[], size_t len);
 
 int sensors_drivers_read_value(sensor_t *sensors);
 void sensors_drivers_write_value(sensor_t *sensors, u8 value);
 
+/* Read a new value, then tell whether an alert must be emitted (user_application.c) */
+value_t sensor_poll(sensor_t *sensor);
+bool sensor_criticality(sensor_t *sensor);
+
+/* Time at which iterative_tasks() has something to do, the task can sleep until then */
+portTickType application_next_wakeup();
+
 #endif
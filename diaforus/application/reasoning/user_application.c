@@ -15,6 +15,7 @@
 #include <FreeRTOS.h>
 #include <task.h>
 #include <croutine.h>
+#include <semphr.h>
 #include <stdlib.h>
 
 #include "reasoning_debug.h"
@@ -30,6 +31,7 @@
 #include "sensor_pir.h"
 #include "sensor_spirit.h"
 #include "sensor_switch.h"
+#include "sensor_events.h"
 
 #include "sensors_config.h"
 #include "reasoning_config.h"
@@ -57,6 +59,12 @@ static void *crash_handler(int signum);
 		
 #define BOOTSTRAPING_CHECK_PERIOD 20000
 
+/* Longest sleep of the task between two iterative_tasks(), in ticks */
+#define APPLICATION_MAX_SLEEP 1000
+
+/* Given to wake the task up before application_next_wakeup() */
+static xSemaphoreHandle application_wakeup;
+
 /*----------------------------------------------------------------------------*/
 
 #if 0
@@ -150,22 +158,32 @@ static bool sensor_criticality_pir_seismic(sensor_t* sensor)
 	return false;
 }
 
-static bool sensor_criticality(sensor_t *sensor)
+/* A new modality registers its driver here */
+const sensor_ops_t sensor_modality_ops[NUMBER_OF_MODALITIES] = {
+	[PIR_MOD] = { sensor_poll_pir, sensor_criticality_pir_seismic, sensor_calibration_digital },
+	[SPIRIT_MOD] = { sensor_poll_spirit, sensor_criticality_pir_seismic, sensor_calibration_digital },
+	[SEISMIC_MOD] = { sensor_poll_seismic, sensor_criticality_pir_seismic, sensor_calibration_digital },
+	[SWITCH_MOD] = { sensor_poll_switch, sensor_criticality_pir_seismic, sensor_calibration_digital },
+};
+
+#if SENSOR_EVENT_DRIVEN
+const sensor_ops_t sensor_modality_edge_ops[NUMBER_OF_MODALITIES] = {
+	[PIR_MOD] = { sensor_poll_edges, sensor_criticality_pir_seismic, sensor_calibration_digital },
+	[SEISMIC_MOD] = { sensor_poll_edges, sensor_criticality_pir_seismic, sensor_calibration_digital },
+	[SWITCH_MOD] = { sensor_poll_edges, sensor_criticality_pir_seismic, sensor_calibration_digital },
+};
+#endif
+
+/* When all the sensors of the node share a modality (sensors_config.h), its driver is called directly */
+#if defined(SENSOR_MODALITY) && !defined(SENSOR_DYNAMIC_DISPATCH) && !SENSOR_EVENT_DRIVEN
+#define sensor_ops(sensor) (&sensor_modality_ops[SENSOR_MODALITY])
+#else
+#define sensor_ops(sensor) ((sensor)->ops)
+#endif
+
+bool sensor_criticality(sensor_t *sensor)
 {
-	switch (sensor->modality)
-	{
-	case PIR_MOD:
-	case SEISMIC_MOD:
-	case SPIRIT_MOD:	
-	case SWITCH_MOD:
-		return sensor_criticality_pir_seismic(sensor);
-	
-		//return sensor_criticality_digital(sensor);
-	case INVALID_MOD:
-	case NUMBER_OF_MODALITIES:
-		break;
-	}
-	return false;
+	return sensor_ops(sensor)->criticality(sensor);
 }
 
 
@@ -176,23 +194,7 @@ value_t sensor_poll(sensor_t *sensor)
 	/* set when the next read should happen */
 	sensor->next_read = time_get() + sensor->periodicity;
 
-	switch (sensor->modality)
-	{
-	case PIR_MOD:
-		value = sensor_poll_pir(sensor);
-		break;
-	case SPIRIT_MOD:
-		value = sensor_poll_spirit(sensor);
-		break;
-	case SEISMIC_MOD:
-		value = sensor_poll_seismic(sensor);
-		break;
-	case SWITCH_MOD:
-		value = sensor_poll_switch(sensor);
-		break;	
-	default:
-		value = 0;
-	}
+	value = sensor_ops(sensor)->poll(sensor);
 
 	DEBUG("APP", LOG_DEBUG, "SENSOR %s ID %d : Read (%i)\n",
 			modality_string(sensor->modality), sensor->id, value);
@@ -200,6 +202,126 @@ value_t sensor_poll(sensor_t *sensor)
 	return value;
 }
 
+/******** Poll scheduling ********/
+
+/* Min-heap of the sensor indexes on (next_read, index), the next sensor to poll first */
+static uint8_t poll_heap[SENSOR_COUNT];
+static uint8_t poll_heap_pos[SENSOR_COUNT];
+
+static inline bool poll_before(uint8_t a, uint8_t b)
+{
+	if (sensors[a].next_read != sensors[b].next_read)
+		return time_before(sensors[a].next_read, sensors[b].next_read);
+	return a < b;
+}
+
+static inline void poll_heap_swap(uint8_t a, uint8_t b)
+{
+	uint8_t tmp = poll_heap[a];
+
+	poll_heap[a] = poll_heap[b];
+	poll_heap[b] = tmp;
+	poll_heap_pos[poll_heap[a]] = a;
+	poll_heap_pos[poll_heap[b]] = b;
+}
+
+static void poll_heap_sift_down(uint8_t pos)
+{
+	uint8_t child;
+
+	while ((child = 2 * pos + 1) < SENSOR_COUNT)
+	{
+		if (child + 1 < SENSOR_COUNT && poll_before(poll_heap[child + 1], poll_heap[child]))
+			child++;
+		if (!poll_before(poll_heap[child], poll_heap[pos]))
+			break;
+		poll_heap_swap(pos, child);
+		pos = child;
+	}
+}
+
+static void poll_heap_init()
+{
+	int i;
+
+	for (i = 0; i < SENSOR_COUNT; i++)
+	{
+		poll_heap[i] = i;
+		poll_heap_pos[i] = i;
+	}
+	for (i = SENSOR_COUNT / 2 - 1; i >= 0; i--)
+		poll_heap_sift_down(i);
+}
+
+#if SENSOR_EVENT_DRIVEN
+/* Polls the sensor at time instead of its next_read */
+static void poll_heap_reschedule(uint8_t sensor, portTickType time)
+{
+	uint8_t pos = poll_heap_pos[sensor];
+
+	sensors[sensor].next_read = time;
+	while (pos > 0 && poll_before(poll_heap[pos], poll_heap[(pos - 1) / 2]))
+	{
+		poll_heap_swap(pos, (pos - 1) / 2);
+		pos = (pos - 1) / 2;
+	}
+	poll_heap_sift_down(pos);
+}
+
+/* Records the edges reported since the previous call, a rising one is polled at once */
+static void sensor_events_dispatch()
+{
+	sensor_event_t event;
+
+	while (sensor_events_pop(&event))
+	{
+		if (event.sensor >= SENSOR_COUNT || !sensor_events_attached(&sensors[event.sensor]))
+			continue;
+		if (sensor_events_apply(&sensors[event.sensor], &event))
+			poll_heap_reschedule(event.sensor, event.time);
+	}
+}
+#endif
+
+portTickType application_next_wakeup()
+{
+	portTickType wakeup = portMAX_DELAY;
+
+#if !IS_SIMU && (HW_MODALITY==WITH_ACTUATOR)
+	/* the actuators are driven on each call until actuator_cnt runs out */
+	if (actuator_cnt > 0)
+		return time_get();
+#elif !ROLE_REASONING
+	if (!acked_by_reasoning)
+		wakeup = next_periodic_ack_check;
+#endif
+#if SENSOR_EVENT_DRIVEN
+	if (sensor_events_pending())
+		return time_get();
+#endif
+	if (SENSOR_COUNT && time_before(sensors[poll_heap[0]].next_read, wakeup))
+		wakeup = sensors[poll_heap[0]].next_read;
+#if ROLE_REASONING
+	if (time_before(reasoning_next_flush(), wakeup))
+		wakeup = reasoning_next_flush();
+	if (time_before(reasoning_coap_next_notify(), wakeup))
+		wakeup = reasoning_coap_next_notify();
+#endif
+	return wakeup;
+}
+
+/* Blocks until application_next_wakeup(), a notification or a stimulus */
+static void application_sleep()
+{
+	portTickType now = time_get(), wakeup = application_next_wakeup();
+	portTickType delay = APPLICATION_MAX_SLEEP;
+
+	if (time_before(wakeup, now + APPLICATION_MAX_SLEEP))
+		delay = time_before(now, wakeup) ? wakeup - now : 0;
+	if (delay > 0)
+		xSemaphoreTake(application_wakeup, delay);
+}
+
 void application()
 {
 	DEBUG("APP", LOG_DEBUG, "Application started");
@@ -207,6 +329,9 @@ void application()
 
 	acked_by_reasoning = false;
 
+	/* created given, taken back by the first sleep */
+	vSemaphoreCreateBinary(application_wakeup);
+
 	// Memory initialization (for real nodes)
 	sensors_init();
 	coap_service_init();//to remove because now this call is in hk_appli_initialization2()
@@ -218,7 +343,9 @@ void application()
 	debug_led(LED_APPLICATION_STARTED, 1);
 
 	/* Init the sensors */
+	sensor_events_init();
 	sensors_drivers_init(sensors, SENSOR_COUNT);
+	poll_heap_init();
 
 	/* --- Init reasoning unconditionally ---*/
 	reasoning_init();
@@ -251,11 +378,11 @@ void application()
 
 void iterative_tasks()
 {
-	int i;
+	int i, n;
 
 	DEBUG("APP", LOG_DEBUG, "Iterative_tasks():\n");
 #if !ROLE_REASONING
-	if (!acked_by_reasoning && time_get() >= next_periodic_ack_check) {
+	if (!acked_by_reasoning && !time_before(time_get(), next_periodic_ack_check)) {
 		const char * pubAttributes[] = { "BTNEWN", "BTAREA", "BTNB" };
 		value_t pubValues[] = { NODE_ID, AREA_ID, SENSOR_COUNT };
 
@@ -265,23 +392,30 @@ void iterative_tasks()
 	}
 #endif
 	/* poll the connected sensors and emit alerts if needed */
+#if !IS_SIMU && (HW_MODALITY==WITH_ACTUATOR)
 	for (i = 0; i < SENSOR_COUNT; i++)
 	{
-#if !IS_SIMU && (HW_MODALITY==WITH_ACTUATOR)
 	    if (actuator_cnt > 0){
 	    	actuator_cnt --;
 	    	sensors_drivers_write_value(&sensors[i],1 );
 	    } else {
 	    	sensors_drivers_write_value(&sensors[i],0 );
 	    }
-	    
-#else		
-	    debug_led(LED_SWITCH_0_PUBLISH, 0);
+	}
+#else
+	debug_led(LED_SWITCH_0_PUBLISH, 0);
+#if SENSOR_EVENT_DRIVEN
+	sensor_events_dispatch();
+#endif
 
-		if (time_get() < sensors[i].next_read)
-			continue;
+	/* only the sensors which are due, each one at most once per call */
+	for (n = 0; n < SENSOR_COUNT && !time_before(time_get(), sensors[poll_heap[0]].next_read); n++)
+	{
+		i = poll_heap[0];
 
 		sensor_poll(&sensors[i]);
+		poll_heap_sift_down(0);
+
 		if (sensor_criticality(&sensors[i]))
 		{
 			const char * pubAttributes[3];
@@ -299,9 +433,14 @@ void iterative_tasks()
 			debug_led(LED_SWITCH_0_PUBLISH, 1);
 			Publish(pubAttributes, pubValues, 3, 0);
 		}
-#endif
 	}
+#endif
+#if ROLE_REASONING
+	reasoning_flush_alerts();
+	reasoning_coap_notify();
+#endif
 	DEBUG("APP", LOG_DEBUG, "</Iterative_tasks>\n\n");
+	application_sleep();
 }
 
 void Notify(const char * const attributes[], const value_t values[], uint8_t subscriptionId)
@@ -320,6 +459,8 @@ void Notify(const char * const attributes[], const value_t values[], uint8_t sub
 		DEBUG("BOOTSTRAPING", LOG_INFO, "Confirmation received from reasoning (acked = %u)\n", acked_by_reasoning);
 #endif
 	}
+	/* the alerts to flush or the acknowledgement change application_next_wakeup() */
+	xSemaphoreGive(application_wakeup);
 	/* The notification isn't meant for the reasoning nor the gateway */
 }
 
@@ -342,11 +483,30 @@ void simulate_stimulus(uint8_t sensor_id, uint8_t value)
 	{
 		if (sensors[i].modality == modality && sensors[i].id == id)
 		{
+#if SENSOR_EVENT_DRIVEN
+			/* Stands for the interrupt handler: a stimulus is a pulse, as seen by one poll */
+			if (sensor_events_attached(&sensors[i]))
+			{
+				if (value & 0x1)
+				{
+					sensor_events_push(i, 1, time_get());
+					sensor_events_push(i, 0, time_get());
+					xSemaphoreGive(application_wakeup);
+				}
+				return;
+			}
+#endif
 			if (modality == PIR_MOD || modality == SEISMIC_MOD)
 				sensors[i].stimulus[0] = value;
 			else if (modality == SPIRIT_MOD)
 			{
 				uint8_t beam = (value >> 4) & 0xf;
+				if (beam >= SENSOR_SPIRIT_BEAM_COUNT)
+				{
+					DEBUG("APP", LOG_CRITICAL, "Stimulus received for a non-existing beam %u of %s-%u\n",
+					      beam, modality_string(modality), id);
+					return;
+				}
 				sensors[i].stimulus[beam] = value & 0xf;
 			}
 			return;
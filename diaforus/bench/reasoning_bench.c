@@ -0,0 +1,355 @@
+/*
+ * reasoning_bench.c
+ *
+ * Host benchmark of the reasoning: the reasoning sources are linked against
+ * the stubs of bench/stubs and fed with an alert stream on a virtual clock,
+ * either synthetic or replayed from a file.
+ *
+ *   reasoning_bench [-s seed] [-n alerts] [-N nodes] [-S sensors] [-v]
+ *   reasoning_bench [-v] -r stream.csv
+ *
+ * A stream file holds one message per line ('#' starts a comment):
+ *
+ *   <time ms>, ALERT, <sensor id>, <value>
+ *   <time ms>, AREA, <monitored area index>, <percent>   (summary of the area)
+ *   <time ms>, BOOT, <node id>, <sensor count>
+ *   <time ms>, FAIL, <node id>
+ *
+ * which is what stimulus_replay -a prints.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "reasoning_service.h"
+#include "reasoning_service_p.h"
+#include "reasoning_history.h"
+#include "reasoning_history_p.h"
+#include "reputation_management.h"
+
+#define BENCH_AREA_SUBS_MAX 8
+
+typedef struct
+{
+	uint32_t calls;
+	uint64_t total_ns;
+	uint64_t worst_ns;
+} bench_timing_t;
+
+typedef struct
+{
+	uint64_t total;
+	uint8_t max;
+} bench_occupancy_t;
+
+static portTickType now;
+static bool verbose;
+
+static uint8_t next_sub;
+static uint8_t alert_sub = UINT8_MAX, bootstrap_sub = UINT8_MAX, failure_sub = UINT8_MAX;
+static uint8_t area_subs[BENCH_AREA_SUBS_MAX];
+static uint8_t area_subs_count;
+
+static uint32_t alarms_published;
+static bench_timing_t update_timing, criticality_timing;
+static bench_occupancy_t events_occupancy, states_occupancy, alerts_occupancy, updates_occupancy;
+
+/* Defined by user_application.c on the nodes */
+uint8_t sensor_count;
+
+/*********** Stubs ***********/
+
+portTickType time_get(void)
+{
+	return now;
+}
+
+void debug(const char *module, int level, const char *format, ...)
+{
+	va_list ap;
+
+	if (!verbose)
+		return;
+	fprintf(stderr, "%8u %s: ", now, module);
+	va_start(ap, format);
+	vfprintf(stderr, format, ap);
+	va_end(ap);
+}
+
+uint8_t Subscribe(const char *attributes[], Operator operators[], value_t values[], int count)
+{
+	if (strcmp(attributes[0], "SENSID") == 0)
+		alert_sub = next_sub;
+	else if (strcmp(attributes[0], "BTNEWN") == 0)
+		bootstrap_sub = next_sub;
+	else if (strcmp(attributes[0], "FAIL") == 0)
+		failure_sub = next_sub;
+	else if (strcmp(attributes[0], "SumAr") == 0 && area_subs_count < BENCH_AREA_SUBS_MAX)
+		area_subs[area_subs_count++] = next_sub;
+	return next_sub++;
+}
+
+void Publish(const char *attributes[], value_t values[], int count, int flags)
+{
+	if (strcmp(attributes[0], "AlmLvl") != 0)
+		return;
+	alarms_published++;
+	if (verbose)
+		fprintf(stderr, "%8u ALARM: level=%u, area=%u, nodes=%x, duration=%u\n",
+			now, values[0], values[2], values[3], values[4]);
+}
+
+/*********** Measures ***********/
+
+static uint64_t clock_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void timing_add(bench_timing_t *t, uint64_t ns)
+{
+	t->calls++;
+	t->total_ns += ns;
+	if (ns > t->worst_ns)
+		t->worst_ns = ns;
+}
+
+static void occupancy_add(bench_occupancy_t *o, uint8_t used)
+{
+	o->total += used;
+	if (used > o->max)
+		o->max = used;
+}
+
+/*********** Messages ***********/
+
+static void bench_alert(sensorid_t sensorid, uint8_t value)
+{
+	value_t values[3] = { sensorid, value, AREA_ID };
+	uint8_t events, states, alerts;
+	uint64_t start;
+	volatile uint16_t criticality;
+
+	start = clock_ns();
+	reasoning_update(NULL, values, alert_sub);
+	timing_add(&update_timing, clock_ns() - start);
+
+	start = clock_ns();
+	criticality = get_criticality_level();
+	timing_add(&criticality_timing, clock_ns() - start);
+	(void) criticality;
+
+	reasoning_history_occupancy(&events, &states, &alerts);
+	occupancy_add(&events_occupancy, events);
+	occupancy_add(&states_occupancy, states);
+	occupancy_add(&alerts_occupancy, alerts);
+	occupancy_add(&updates_occupancy, sensors_updates.size);
+}
+
+static void bench_area(uint8_t index, uint16_t percent)
+{
+	static uint16_t previous[BENCH_AREA_SUBS_MAX];
+	value_t values[4] = { 0, percent, 0, 0 };
+
+	if (index >= area_subs_count)
+		return;
+	values[2] = (int32_t) percent - previous[index];
+	previous[index] = percent;
+	reasoning_update(NULL, values, area_subs[index]);
+}
+
+static void bench_bootstrap(uint8_t node, uint8_t sensors)
+{
+	value_t values[3] = { node, AREA_ID, sensors };
+
+	reasoning_update(NULL, values, bootstrap_sub);
+	sensor_count += sensors;
+}
+
+static void bench_failure(uint8_t node)
+{
+	value_t values[2] = { 1, node };
+
+	reasoning_update(NULL, values, failure_sub);
+}
+
+/*********** Streams ***********/
+
+/*
+ * Intrusions crossing the nodes one after the other, every sensor of the
+ * crossed node raising a few alerts, over a background of isolated alerts.
+ */
+static void synthetic_stream(unsigned int alerts, uint8_t nodes, uint8_t sensors)
+{
+	unsigned int sent = 0;
+	uint8_t node, intruded = 0, i;
+
+	for (node = 1; node <= nodes; node++)
+		bench_bootstrap(node, sensors);
+
+	while (sent < alerts)
+	{
+		if (intruded == 0 && rand() % 100 < 5)
+			intruded = 1;
+
+		if (intruded)
+		{
+			for (i = 0; i < sensors && sent < alerts; i++, sent++)
+			{
+				now += rand() % 500;
+				bench_alert(intruded << 8 | (i % 4) << 4 | i / 4, rand() % 3 + 1);
+			}
+			if (rand() % 10 == 0)
+				bench_area(rand() % BENCH_AREA_SUBS_MAX, rand() % 200);
+			intruded = (intruded < nodes) ? intruded + 1 : 0;
+		}
+		else
+		{
+			now += rand() % 10000;
+			i = rand() % sensors;
+			bench_alert((rand() % nodes + 1) << 8 | (i % 4) << 4 | i / 4, 1);
+			sent++;
+		}
+	}
+}
+
+static int replay_stream(const char *filename)
+{
+	char line[128], type[8];
+	unsigned int time, id, value, line_number = 0;
+	FILE *f = fopen(filename, "r");
+
+	if (f == NULL)
+	{
+		perror(filename);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f) != NULL)
+	{
+		line_number++;
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		value = 0;
+		if (sscanf(line, "%u , %7[A-Z] , %i , %i", &time, type, &id, &value) < 3)
+		{
+			fprintf(stderr, "%s:%u: malformed line\n", filename, line_number);
+			continue;
+		}
+		if (time < now)
+			fprintf(stderr, "%s:%u: time goes backward\n", filename, line_number);
+		else
+			now = time;
+
+		if (strcmp(type, "ALERT") == 0)
+			bench_alert(id, value);
+		else if (strcmp(type, "AREA") == 0)
+			bench_area(id, value);
+		else if (strcmp(type, "BOOT") == 0)
+			bench_bootstrap(id, value);
+		else if (strcmp(type, "FAIL") == 0)
+			bench_failure(id);
+		else if (strcmp(type, "ALARM") == 0)
+			continue; // result of stimulus_replay -a, not an input
+		else
+			fprintf(stderr, "%s:%u: unknown message %s\n", filename, line_number, type);
+	}
+	fclose(f);
+	return 0;
+}
+
+/*********** Report ***********/
+
+static void report_timing(const char *name, const bench_timing_t *t)
+{
+	printf("%-24s %10u %10llu %10llu\n", name, t->calls,
+	       (unsigned long long) (t->calls ? t->total_ns / t->calls : 0),
+	       (unsigned long long) t->worst_ns);
+}
+
+static void report_occupancy(const char *name, const bench_occupancy_t *o, unsigned int size)
+{
+	uint32_t calls = update_timing.calls ? update_timing.calls : 1;
+
+	if (size)
+		printf("%-24s %10.1f %10u %10u\n", name, (double) o->total / calls, o->max, size);
+	else
+		printf("%-24s %10.1f %10u %10s\n", name, (double) o->total / calls, o->max, "-");
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-s seed] [-n alerts] [-N nodes] [-S sensors] [-r stream.csv] [-v]\n", name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int seed = 1, alerts = 100000;
+	unsigned int nodes = 4, sensors = 4;
+	const char *stream = NULL;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:n:N:S:r:v")) != -1)
+	{
+		switch (opt)
+		{
+		case 's':
+			seed = atoi(optarg);
+			break;
+		case 'n':
+			alerts = atoi(optarg);
+			break;
+		case 'N':
+			nodes = atoi(optarg);
+			break;
+		case 'S':
+			sensors = atoi(optarg);
+			break;
+		case 'r':
+			stream = optarg;
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	// The reasoning registers at most 16 nodes, the sensor ids address 4 modalities of 16 sensors
+	if (nodes < 1 || nodes > 16 || sensors < 1 || sensors > 64)
+		usage(argv[0]);
+
+	srand(seed);
+	reasoning_history_init();
+	reputation_management_init();
+	reasoning_init();
+
+	if (stream != NULL)
+	{
+		if (replay_stream(stream) < 0)
+			return 1;
+	}
+	else
+		synthetic_stream(alerts, nodes, sensors);
+
+	printf("%u alerts, %u alarms, %u ms of virtual time\n\n", update_timing.calls, alarms_published, now);
+	printf("%-24s %10s %10s %10s\n", "", "calls", "mean ns", "worst ns");
+	report_timing("reasoning_update", &update_timing);
+	report_timing("get_criticality_level", &criticality_timing);
+	printf("\n%-24s %10s %10s %10s\n", "table", "mean", "max", "size");
+	report_occupancy("suspicious events", &events_occupancy, SUSPICIOUS_STATE_HISTORY_SIZE);
+	report_occupancy("sensor states", &states_occupancy, SENSOR_STATE_COUNT);
+	report_occupancy("alerts", &alerts_occupancy, 0);
+	report_occupancy("sensor updates", &updates_occupancy, ALERT_HISTORY_SIZE);
+	return 0;
+}
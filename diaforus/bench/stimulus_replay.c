@@ -0,0 +1,487 @@
+/*
+ * stimulus_replay.c
+ *
+ * Deterministic replay of a stimulus log into the node application, without
+ * the dispatcher: the stimuli are given to simulate_stimulus() and the node
+ * runs iterative_tasks() on a virtual clock, as fast as possible. The ticks
+ * where neither the node nor the emulated nodes have anything to do are
+ * skipped, like the node task sleeps until application_next_wakeup().
+ *
+ *   stimulus_replay [-t tick ms] [-a] [-v] dumped_stimulus.log
+ *
+ * The log is either written by dispatcher.py (dumped_stimulus.log) or an
+ * input CSV of inject-stimulus.py:
+ *
+ *   <time s>, <node id>, <PIR|SPIRIT|SEISMIC|SWITCH>, <sensor>, <value>[, <SPIRIT beam value>]
+ *
+ * Stimuli of the node this program is built for (NODE_ID) go through its own
+ * sensors. The other nodes of the log are emulated: each of their sensors is
+ * a copy of a local sensor of the same modality, polled on the same clock,
+ * and their alerts are published to the reasoning like on the network.
+ *
+ * The alarms are printed on the standard output, with -a the bootstraps and
+ * the alerts are printed too, in the stream format of reasoning_bench.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "user_application.h"
+#include "reasoning_service.h"
+#include "sensors_drivers.h"
+#include "sensor_events.h"
+#include "debug_led_mapping.h"
+#include "coap_service.h"
+
+#define REPLAY_SUBSCRIPTIONS_MAX 16
+#define REPLAY_ATTRIBUTES_MAX 5
+#define REPLAY_REMOTE_SENSORS_MAX 64
+
+typedef struct
+{
+	const char *attributes[REPLAY_ATTRIBUTES_MAX];
+	Operator operators[REPLAY_ATTRIBUTES_MAX];
+	value_t values[REPLAY_ATTRIBUTES_MAX];
+	int count;
+} replay_subscription_t;
+
+typedef struct
+{
+	uint32_t time; // ms
+	uint16_t node;
+	uint8_t sensor; // modality << 4 | id, as sent by the dispatcher
+	uint8_t value;
+} replay_stimulus_t;
+
+typedef struct
+{
+	uint16_t node;
+	sensor_t sensor;
+} remote_sensor_t;
+
+static portTickType now;
+static bool verbose, print_alerts;
+
+static replay_subscription_t subscriptions[REPLAY_SUBSCRIPTIONS_MAX];
+static uint8_t subscription_count;
+
+static replay_stimulus_t *stimuli;
+static uint32_t stimulus_count;
+
+static remote_sensor_t remote_sensors[REPLAY_REMOTE_SENSORS_MAX];
+static uint8_t remote_sensor_count;
+
+static uint32_t alerts_published, alarms_published, stimuli_dropped;
+
+extern sensor_t sensors[];
+extern uint8_t sensor_count;
+
+/*********** Stubs ***********/
+
+portTickType time_get(void)
+{
+	return now;
+}
+
+void debug(const char *module, int level, const char *format, ...)
+{
+	va_list ap;
+
+	if (!verbose)
+		return;
+	fprintf(stderr, "%8u %s: ", now, module);
+	va_start(ap, format);
+	vfprintf(stderr, format, ap);
+	va_end(ap);
+}
+
+void debug_led(int led, int value)
+{
+}
+
+void coap_service_init(void)
+{
+}
+
+void reasoning_coap_notify(void)
+{
+}
+
+portTickType reasoning_coap_next_notify(void)
+{
+	return portMAX_DELAY;
+}
+
+/*********** Broker ***********/
+
+uint8_t Subscribe(const char *attributes[], Operator operators[], value_t values[], int count)
+{
+	replay_subscription_t *sub = &subscriptions[subscription_count];
+
+	if (subscription_count == REPLAY_SUBSCRIPTIONS_MAX || count > REPLAY_ATTRIBUTES_MAX)
+	{
+		fprintf(stderr, "Too many subscriptions\n");
+		exit(1);
+	}
+	memcpy(sub->attributes, attributes, count * sizeof(*attributes));
+	memcpy(sub->operators, operators, count * sizeof(*operators));
+	memcpy(sub->values, values, count * sizeof(*values));
+	sub->count = count;
+	return subscription_count++;
+}
+
+static bool subscription_matches(const replay_subscription_t *sub, const char *attributes[], value_t values[], int count)
+{
+	int i;
+
+	if (sub->count != count)
+		return false;
+	for (i = 0; i < count; i++)
+	{
+		if (strcmp(sub->attributes[i], attributes[i]) != 0)
+			return false;
+		switch (sub->operators[i])
+		{
+		case EQ: if (!(values[i] == sub->values[i])) return false; break;
+		case NE: if (!(values[i] != sub->values[i])) return false; break;
+		case GT: if (!(values[i] > sub->values[i])) return false; break;
+		case GE: if (!(values[i] >= sub->values[i])) return false; break;
+		case LT: if (!(values[i] < sub->values[i])) return false; break;
+		case LE: if (!(values[i] <= sub->values[i])) return false; break;
+		}
+	}
+	return true;
+}
+
+void Publish(const char *attributes[], value_t values[], int count, int flags)
+{
+	uint8_t i;
+
+	if (strcmp(attributes[0], "AlmLvl") == 0)
+	{
+		alarms_published++;
+		printf("%u, ALARM, %u, %u, 0x%x, %u\n", now, values[0], values[2], values[3], values[4]);
+	}
+	else if (strcmp(attributes[0], "SENSID") == 0)
+	{
+		alerts_published++;
+		if (print_alerts)
+			printf("%u, ALERT, 0x%x, %u\n", now, values[0], values[1]);
+	}
+	else if (strcmp(attributes[0], "BTNEWN") == 0 && print_alerts)
+		printf("%u, BOOT, %u, %u\n", now, values[0], values[2]);
+
+	// Delivered to the local subscriptions only, as the broker would do
+	for (i = 0; i < subscription_count; i++)
+		if (subscription_matches(&subscriptions[i], attributes, values, count))
+			Notify(attributes, values, i);
+}
+
+/*********** Remote nodes ***********/
+
+static remote_sensor_t *remote_sensor_lookup(uint16_t node, uint8_t sensor)
+{
+	uint8_t i;
+
+	for (i = 0; i < remote_sensor_count; i++)
+		if (remote_sensors[i].node == node &&
+		    remote_sensors[i].sensor.modality == ((sensor >> 4) & 0xf) &&
+		    remote_sensors[i].sensor.id == (sensor & 0xf))
+			return &remote_sensors[i];
+	return NULL;
+}
+
+/* A remote sensor behaves like the first local sensor of its modality */
+static remote_sensor_t *remote_sensor_add(uint16_t node, uint8_t sensor, uint16_t tick)
+{
+	remote_sensor_t *rs;
+	uint8_t i;
+
+	if (remote_sensor_count == REPLAY_REMOTE_SENSORS_MAX)
+		return NULL;
+	rs = &remote_sensors[remote_sensor_count++];
+	rs->node = node;
+
+	for (i = 0; i < sensor_count; i++)
+		if (sensors[i].modality == ((sensor >> 4) & 0xf))
+			break;
+	if (i < sensor_count)
+		rs->sensor = sensors[i];
+	else
+	{
+		memset(&rs->sensor, 0, sizeof(rs->sensor));
+		rs->sensor.connection = CONNECT_GPIO;
+		rs->sensor.value_type = DIGITAL_VALUE;
+		rs->sensor.periodicity = tick;
+		rs->sensor.reemission_delay = 1000;
+		rs->sensor.abs_threshold = 1;
+		rs->sensor.rel_threshold = 1;
+	}
+	rs->sensor.modality = (sensor >> 4) & 0xf;
+	rs->sensor.id = sensor & 0xf;
+	sensors_drivers_init(&rs->sensor, 1);
+	rs->sensor.next_read = 0;
+	rs->sensor.last_alert = 0;
+	rs->sensor.normalized_value = 0;
+	rs->sensor.old_variation = 0;
+	memset(&rs->sensor.history, 0, sizeof(rs->sensor.history));
+	for (i = 0; i < SENSOR_SPIRIT_BEAM_COUNT; i++)
+		rs->sensor.stimulus[i] = UINT8_MAX;
+	return rs;
+}
+
+/* Same dispatching as simulate_stimulus() */
+static void remote_sensor_stimulus(remote_sensor_t *rs, uint8_t value)
+{
+	uint8_t beam = (value >> 4) & 0xf;
+
+#if SENSOR_EVENT_DRIVEN
+	if (sensor_events_attached(&rs->sensor))
+	{
+		sensor_event_t edge = { now, 0, 1 };
+
+		if (value & 0x1)
+		{
+			if (sensor_events_apply(&rs->sensor, &edge))
+				rs->sensor.next_read = now;
+			edge.level = 0;
+			sensor_events_apply(&rs->sensor, &edge);
+		}
+		return;
+	}
+#endif
+	if (rs->sensor.modality != SPIRIT_MOD)
+		rs->sensor.stimulus[0] = value;
+	else if (beam < SENSOR_SPIRIT_BEAM_COUNT)
+		rs->sensor.stimulus[beam] = value & 0xf;
+}
+
+static void remote_nodes_bootstrap(void)
+{
+	const char *attributes[] = { "BTNEWN", "BTAREA", "BTNB" };
+	value_t values[3];
+	uint8_t i, j, count;
+
+	for (i = 0; i < remote_sensor_count; i++)
+	{
+		for (j = 0; j < i; j++)
+			if (remote_sensors[j].node == remote_sensors[i].node)
+				break;
+		if (j < i)
+			continue;
+		for (j = i, count = 0; j < remote_sensor_count; j++)
+			if (remote_sensors[j].node == remote_sensors[i].node)
+				count++;
+		values[0] = remote_sensors[i].node;
+		values[1] = AREA_ID;
+		values[2] = count;
+		Publish(attributes, values, 3, 0);
+	}
+}
+
+/* The iterative_tasks() of the remote nodes */
+static void remote_nodes_poll(void)
+{
+	const char *attributes[] = { "SENSID", "VAL", "AREA" };
+	value_t values[3];
+	remote_sensor_t *rs;
+	uint8_t i;
+
+	for (i = 0; i < remote_sensor_count; i++)
+	{
+		rs = &remote_sensors[i];
+		if (time_get() < rs->sensor.next_read)
+			continue;
+		sensor_poll(&rs->sensor);
+		if (!sensor_criticality(&rs->sensor))
+			continue;
+		values[0] = (rs->node & 0xff) << 8 | (rs->sensor.modality & 0xf) << 4 | (rs->sensor.id & 0xf);
+		values[1] = rs->sensor.normalized_value;
+		values[2] = AREA_ID;
+		Publish(attributes, values, 3, 0);
+	}
+}
+
+/* The first tick at which the node, the emulated nodes or the log have something to do */
+static portTickType next_tick(uint32_t next, portTickType tick, portTickType end)
+{
+	portTickType wakeup = application_next_wakeup();
+	uint8_t i;
+
+	if (next < stimulus_count && stimuli[next].time < wakeup)
+		wakeup = stimuli[next].time;
+	for (i = 0; i < remote_sensor_count; i++)
+		if (remote_sensors[i].sensor.next_read < wakeup)
+			wakeup = remote_sensors[i].sensor.next_read;
+
+	if (wakeup <= now + tick)
+		return now + tick;
+	if (wakeup > end)
+		return end + tick;
+	return (wakeup + tick - 1) / tick * tick;
+}
+
+/*********** Log ***********/
+
+static int modality_from_string(const char *s)
+{
+	modality_t m;
+
+	for (m = 0; m < NUMBER_OF_MODALITIES; m++)
+		if (strcmp(s, modality_string(m)) == 0)
+			return m;
+	// modality_string() abbreviates SPIRIT
+	if (strcmp(s, "SPIRIT") == 0)
+		return SPIRIT_MOD;
+	return INVALID_MOD;
+}
+
+static int stimulus_compare(const void *a, const void *b)
+{
+	const replay_stimulus_t *sa = a, *sb = b;
+
+	if (sa->time != sb->time)
+		return sa->time < sb->time ? -1 : 1;
+	// Keep the order of the log for simultaneous stimuli
+	return sa < sb ? -1 : (sa > sb);
+}
+
+static int load_stimuli(const char *filename)
+{
+	char line[128], type[16];
+	unsigned int node, id, value, beam_value, line_number = 0, capacity = 0;
+	double time;
+	int modality, fields;
+	FILE *f = fopen(filename, "r");
+
+	if (f == NULL)
+	{
+		perror(filename);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f) != NULL)
+	{
+		line_number++;
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		fields = sscanf(line, "%lf , %u , %15[A-Z] , %u , %u , %u", &time, &node, type, &id, &value, &beam_value);
+		if (fields >= 3 && strcmp(type, "COAP") == 0)
+			continue;
+		modality = modality_from_string(type);
+		if (fields < 5 || modality == INVALID_MOD || time < 0)
+		{
+			fprintf(stderr, "%s:%u: malformed line\n", filename, line_number);
+			continue;
+		}
+		// inject-stimulus.py gives the beam and its value apart
+		if (modality == SPIRIT_MOD && fields == 6)
+			value = value << 4 | beam_value;
+
+		if (stimulus_count == capacity)
+		{
+			capacity = capacity ? capacity * 2 : 1024;
+			stimuli = realloc(stimuli, capacity * sizeof(*stimuli));
+			if (stimuli == NULL)
+			{
+				perror("realloc");
+				exit(1);
+			}
+		}
+		stimuli[stimulus_count].time = time * 1000;
+		stimuli[stimulus_count].node = node;
+		stimuli[stimulus_count].sensor = modality << 4 | (id & 0xf);
+		stimuli[stimulus_count].value = value;
+		stimulus_count++;
+	}
+	fclose(f);
+	qsort(stimuli, stimulus_count, sizeof(*stimuli), stimulus_compare);
+	return 0;
+}
+
+/*********** Replay ***********/
+
+static void deliver(const replay_stimulus_t *s)
+{
+	remote_sensor_t *rs;
+
+	if (s->node == NODE_ID)
+	{
+		simulate_stimulus(s->sensor, s->value);
+		return;
+	}
+	rs = remote_sensor_lookup(s->node, s->sensor);
+	if (rs != NULL)
+		remote_sensor_stimulus(rs, s->value);
+	else
+		stimuli_dropped++;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-t tick ms] [-a] [-v] dumped_stimulus.log\n", name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int tick = 10;
+	uint32_t i, next = 0, end, wakeups = 0;
+	struct timespec start, stop;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:av")) != -1)
+	{
+		switch (opt)
+		{
+		case 't':
+			tick = atoi(optarg);
+			break;
+		case 'a':
+			print_alerts = true;
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1 || tick == 0)
+		usage(argv[0]);
+	if (load_stimuli(argv[optind]) < 0)
+		return 1;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	application();
+
+	for (i = 0; i < stimulus_count; i++)
+		if (stimuli[i].node != NODE_ID && remote_sensor_lookup(stimuli[i].node, stimuli[i].sensor) == NULL)
+			remote_sensor_add(stimuli[i].node, stimuli[i].sensor, tick);
+	remote_nodes_bootstrap();
+
+	// Run until the last alerts have no more weight in the criticality
+	end = (stimulus_count ? stimuli[stimulus_count - 1].time : 0) + get_max_intrusion_duration() * 2;
+	for (now = 0; now <= end; now = next_tick(next, tick, end))
+	{
+		while (next < stimulus_count && stimuli[next].time <= now)
+			deliver(&stimuli[next++]);
+		iterative_tasks();
+		remote_nodes_poll();
+		wakeups++;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+
+	fprintf(stderr, "%u stimuli (%u dropped), %u remote sensors, %u alerts, %u alarms\n",
+		stimulus_count, stimuli_dropped, remote_sensor_count, alerts_published, alarms_published);
+	fprintf(stderr, "%u s of virtual time replayed in %.3f s, %u wake-ups of %u ticks\n", end / 1000,
+		(stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9, wakeups, end / tick + 1);
+	free(stimuli);
+	return 0;
+}
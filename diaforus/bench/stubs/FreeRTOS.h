@@ -0,0 +1,24 @@
+/*
+ * FreeRTOS.h
+ *      Host stand-in used by the reasoning bench, only provides the types
+ *      the reasoning sources rely on.
+ */
+
+#ifndef BENCH_FREERTOS_H
+#define BENCH_FREERTOS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+typedef uint32_t portTickType;
+
+/* The virtual clock of the bench counts in milliseconds */
+#define port_tick_to_ms(ticks) (ticks)
+#define portMAX_DELAY ((portTickType) 0xffffffff)
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+
+#endif /* BENCH_FREERTOS_H */
@@ -0,0 +1,9 @@
+/*
+ * application_config.h
+ *      Bench configuration, normally generated by build_network.py.
+ */
+
+#ifndef _APPLICATION_CONFIG_H_
+#define _APPLICATION_CONFIG_H_
+	#define APPLICATION_REASONING
+#endif
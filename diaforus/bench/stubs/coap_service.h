@@ -0,0 +1,11 @@
+/*
+ * coap_service.h
+ *      Host stand-in used by the reasoning bench (no CoAP server).
+ */
+
+#ifndef BENCH_COAP_SERVICE_H
+#define BENCH_COAP_SERVICE_H
+
+void coap_service_init(void);
+
+#endif /* BENCH_COAP_SERVICE_H */
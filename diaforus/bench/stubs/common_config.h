@@ -0,0 +1,17 @@
+/*
+ * common_config.h
+ *      Bench configuration, normally generated by build_network.py.
+ */
+
+#ifndef _COMMON_CONFIG_H_
+#define _COMMON_CONFIG_H_
+
+	#define IS_SIMU 1
+	#define NODE_ID 0x100
+	#define AREA_ID 1
+	#define ROLE_GATEWAY 0
+	#define ROLE_BROKER 0
+	#ifndef DEBUG_REASONING
+	#define DEBUG_REASONING 0
+	#endif
+#endif
@@ -0,0 +1,4 @@
+/*
+ * croutine.h
+ *      Host stand-in used by the reasoning bench (no co-routines).
+ */
@@ -0,0 +1,19 @@
+/*
+ * debug_led_mapping.h
+ *      Host stand-in used by the reasoning bench (no LEDs).
+ */
+
+#ifndef BENCH_DEBUG_LED_MAPPING_H
+#define BENCH_DEBUG_LED_MAPPING_H
+
+enum
+{
+	LED_APPLICATION_STARTED,
+	LED_SWITCH_0_PUBLISH,
+	LED_SWITCH_0_POLLING,
+	LED_SWITCH_0,
+};
+
+void debug_led(int led, int value);
+
+#endif /* BENCH_DEBUG_LED_MAPPING_H */
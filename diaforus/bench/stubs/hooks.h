@@ -0,0 +1,4 @@
+/*
+ * hooks.h
+ *      Host stand-in used by the reasoning bench (no hooks).
+ */
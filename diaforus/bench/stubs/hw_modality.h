@@ -0,0 +1,4 @@
+/*
+ * hw_modality.h
+ *      Host stand-in used by the reasoning bench, the sensors are simulated.
+ */
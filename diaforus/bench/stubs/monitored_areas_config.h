@@ -0,0 +1,17 @@
+/*
+ * monitored_areas_config.h
+ *      Bench configuration, normally generated by build_network.py.
+ */
+
+#ifndef _MONITORED_AREAS_CONFIG_H_
+#define _MONITORED_AREAS_CONFIG_H_
+
+#include "monitored_area.h"
+
+#define MONITORED_AREAS_COUNT 2
+
+monitored_area_t monitored_areas[MONITORED_AREAS_COUNT] = {
+	{ .area = 2, .crossing_duration = 5000 },
+	{ .area = 3, .crossing_duration = 5000 },
+};
+#endif
@@ -0,0 +1,15 @@
+/*
+ * pubsub_api.h
+ *      Host stand-in used by the reasoning bench, Publish() and Subscribe()
+ *      are provided by reasoning_bench.c.
+ */
+
+#ifndef BENCH_PUBSUB_API_H
+#define BENCH_PUBSUB_API_H
+
+#include "pubsub_common.h"
+
+uint8_t Subscribe(const char *attributes[], Operator operators[], value_t values[], int count);
+void Publish(const char *attributes[], value_t values[], int count, int flags);
+
+#endif /* BENCH_PUBSUB_API_H */
@@ -0,0 +1,15 @@
+/*
+ * pubsub_common.h
+ *      Host stand-in used by the reasoning bench.
+ */
+
+#ifndef BENCH_PUBSUB_COMMON_H
+#define BENCH_PUBSUB_COMMON_H
+
+#include <stdint.h>
+
+typedef uint32_t value_t;
+
+typedef enum { EQ, NE, GT, GE, LT, LE } Operator;
+
+#endif /* BENCH_PUBSUB_COMMON_H */
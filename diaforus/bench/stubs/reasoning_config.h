@@ -0,0 +1,36 @@
+/*
+ * reasoning_config.h
+ *      Bench configuration, normally generated by build_network.py.
+ *      The table sizes can be overridden from the command line.
+ */
+
+#ifndef _REASONING_CONFIG_H_
+#define _REASONING_CONFIG_H_
+
+	#define ROLE_REASONING 1
+	#ifndef SENSOR_HISTORY_SIZE
+	#define SENSOR_HISTORY_SIZE 64
+	#endif
+	#define SIMULATION_ENTRY_MAX 50
+	#ifndef ALERT_HISTORY_SIZE
+	#define ALERT_HISTORY_SIZE 16
+	#endif
+	#ifndef SUSPICIOUS_STATE_HISTORY_SIZE
+	#define SUSPICIOUS_STATE_HISTORY_SIZE 16
+	#endif
+	#ifndef SENSOR_CONTRIBUTION_HISTORY_SIZE
+	#define SENSOR_CONTRIBUTION_HISTORY_SIZE 48
+	#endif
+	#define CRITICALITY_THRESHOLD 5
+	#define SENSOR_SPIRIT_BEAM_COUNT 1
+
+	#define MIN_INTRUSION_DURATION (10*1000)
+	#define MAX_INTRUSION_DURATION (20*1000)
+	#define HISTORY_ANALYZE_PERIOD (1440*60*1000)
+	/* Alerts received within this window (ms) are evaluated together, 0 to disable */
+	#ifndef ALERT_COALESCING_WINDOW
+	#define ALERT_COALESCING_WINDOW 0
+	#endif
+	/* 4 levels : green (1), yellow (2), orange (3) and red (4) */
+	#define LATENCY_MODE 100
+#endif
@@ -0,0 +1,46 @@
+/*
+ * sensors_config.h
+ *      Bench configuration, normally generated by build_network.py.
+ */
+
+#ifndef _SENSORS_ROLES_H_
+#define _SENSORS_ROLES_H_
+
+#include "sensors.h"
+
+#define SENSOR_COUNT 3
+
+#define BENCH_SENSOR(mod, sens_id, period, delay) \
+	{ \
+		.modality = mod, \
+		.id = sens_id, \
+		.connection = CONNECT_GPIO, \
+		.periodicity = period, \
+		.reemission_delay = 1000, \
+		.next_read = delay, \
+		.value_type = DIGITAL_VALUE, \
+		.calibration.invert = false, \
+		.abs_threshold = 1, \
+		.rel_threshold = 1, \
+	}
+
+sensor_t sensors[SENSOR_COUNT] __attribute__ (( section (".slowdata") )) = {
+	BENCH_SENSOR(PIR_MOD, 0, 100, 0),
+	BENCH_SENSOR(SPIRIT_MOD, 0, 100, 0),
+	BENCH_SENSOR(SEISMIC_MOD, 0, 100, 0),
+};
+
+static inline void sensors_init()
+{
+	uint8_t i;
+
+	for (i = 0; i < SENSOR_COUNT; i++)
+	{
+		memset(&sensors[i].history, 0, sizeof(sensors[i].history));
+		memset(sensors[i].stimulus, 0, sizeof(sensors[i].stimulus));
+		sensors[i].old_variation = 0;
+		sensors[i].normalized_value = 0;
+		sensors[i].last_alert = 0;
+	}
+}
+#endif
@@ -0,0 +1,18 @@
+/*
+ * sim_common.h
+ *      Host stand-in used by the reasoning bench: the clock and the debug
+ *      output are provided by reasoning_bench.c.
+ */
+
+#ifndef BENCH_SIM_COMMON_H
+#define BENCH_SIM_COMMON_H
+
+#include <arpa/inet.h>
+#include <FreeRTOS.h>
+
+enum { LOG_DEBUG, LOG_INFO, LOG_WARNING, LOG_CRITICAL };
+
+portTickType time_get(void);
+void debug(const char *module, int level, const char *format, ...);
+
+#endif /* BENCH_SIM_COMMON_H */
@@ -0,0 +1,13 @@
+/*
+ * task.h
+ *      Host stand-in used by the reasoning bench (no scheduler).
+ */
+
+#ifndef TASK_H
+#define TASK_H
+
+/* A single thread, nothing to protect */
+#define taskENTER_CRITICAL()
+#define taskEXIT_CRITICAL()
+
+#endif
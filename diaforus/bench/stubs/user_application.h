@@ -0,0 +1,18 @@
+/*
+ * user_application.h
+ *      Host stand-in used by the reasoning bench, entry points of
+ *      user_application.c normally called by the framework.
+ */
+
+#ifndef BENCH_USER_APPLICATION_H
+#define BENCH_USER_APPLICATION_H
+
+#include <stdint.h>
+#include "pubsub_common.h"
+
+void application(void);
+void iterative_tasks(void);
+void Notify(const char * const attributes[], const value_t values[], uint8_t subscriptionId);
+void simulate_stimulus(uint8_t sensor_id, uint8_t value);
+
+#endif /* BENCH_USER_APPLICATION_H */
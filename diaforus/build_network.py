@@ -1,7 +1,7 @@
 #! /usr/bin/python
 
 import select, socket, struct, sys, xml.dom.minidom, time, os 
-import datetime, subprocess, shutil, stat, getopt, signal
+import datetime, subprocess, shutil, stat, getopt, signal, math
 from subprocess import CalledProcessError
 
 area_node_id = dict()
@@ -9,6 +9,9 @@ node_id_list = set()
 subprocesses = list()
 compilation_errors = list()
 
+SLOWDATA_SIZE = 0x2400 # iramd_max in stats_sections.sh
+SLOWDATA_BUDGET = 1536 # default share of the reasoning tables
+
 def printError(msg):
     print '\033[93m' + "\n" + msg + '\033[0m'
 
@@ -220,8 +223,12 @@ def gen_sensors_config(dom, node):
     sensors_file.write("#define _SENSORS_ROLES_H_\n")
     sensors_file.write("\n#include \"sensors.h\"\n")
     sensors_file.write("\n#define SENSOR_COUNT " + str(sensors_count) + "\n")
-    sensors_file.write("\nsensor_t sensors[SENSOR_COUNT] __attribute__ (( section (\".slowdata\") )) = {\n")
     modalities = sensors.getElementsByTagName("modality")
+    # A node with a single modality calls its driver directly
+    mod_types = set([m.getAttribute("type") for m in modalities if len(m.getElementsByTagName("sensor")) > 0])
+    if (len(mod_types) == 1):
+        sensors_file.write("#define SENSOR_MODALITY " + mod_types.pop() + "_MOD\n")
+    sensors_file.write("\nsensor_t sensors[SENSOR_COUNT] __attribute__ (( section (\".slowdata\") )) = {\n")
     for modality in modalities:
         mod_text = modality.getAttribute("type") + "_MOD"
         mod_sensors = modality.getElementsByTagName("sensor")
@@ -343,10 +350,10 @@ def gen_sensors_config(dom, node):
             sensors_file.write("	sensors["+str(sensors_num)+"].periodicity = " + str(period) + ";\n")
             sensors_file.write("	sensors["+str(sensors_num)+"].reemission_delay = " + str(reemission_delay) + ";\n")
             sensors_file.write("	sensors["+str(sensors_num)+"].next_read = " + str(delay) + ";\n")
-            sensors_file.write("	memset(sensors["+str(sensors_num)+"].history.history, 0, 64);\n")
+            sensors_file.write("	memset(sensors["+str(sensors_num)+"].history.history, 0, sizeof(sensors["+str(sensors_num)+"].history.history));\n")
             sensors_file.write("	sensors["+str(sensors_num)+"].history.start = 0;\n")
             sensors_file.write("	sensors["+str(sensors_num)+"].history.end = 0;\n")
-            sensors_file.write("	memset(sensors["+str(sensors_num)+"].stimulus, 0, 15 * sizeof(value_t));\n")
+            sensors_file.write("	memset(sensors["+str(sensors_num)+"].stimulus, 0, sizeof(sensors["+str(sensors_num)+"].stimulus));\n")
             sensors_file.write("	sensors["+str(sensors_num)+"].old_variation = 0;\n")
             #value
             value = mod_sensor.getElementsByTagName("value")[0]
@@ -391,10 +398,95 @@ def gen_sensors_config(dom, node):
     sensors_file.close()
     return 0
 
+def spirit_beam_count(node):
+    beams = 1
+    for sensors in node.getElementsByTagName("sensors"):
+        for modality in sensors.getElementsByTagName("modality"):
+            if modality.getAttribute("type") == "SPIRIT" and len(modality.getAttribute("beams")) > 0:
+                beams = max(beams, int(modality.getAttribute("beams")))
+    if beams > 16:
+        printError("A SPIRIT barrier cannot have more than 16 beams\n")
+        beams = 16
+    return beams
+
+def sensors_event_driven(node):
+    for sensors in node.getElementsByTagName("sensors"):
+        if sensors.getAttribute("event_driven") == "true":
+            return True
+    return False
+
+def sensors_history_runs(node):
+    for sensors in node.getElementsByTagName("sensors"):
+        if sensors.getAttribute("history") == "runs":
+            return True
+    return False
+
+# Bytes taken in .slowdata by the reasoning tables, as laid out by the C sources
+def reasoning_tables(updates, events, states, alerts):
+    return [("sensors_updates", updates * 7 + 1),
+            ("criticality_acc", updates * 4 + 24),
+            ("events", events * 5),
+            ("alerts", alerts * 9),
+            ("sensor_state_table", states * 4),
+            ("history_buffer", 9 + events * 7 + states * 3)]
+
+# Sizes the reasoning tables of the node from the nodes of its area, the expected
+# alert rate and the .slowdata budget, the sensor states taking what is left
+def reasoning_table_sizes(dom, node, reasoning_node, max_intrusion_duration):
+    area = node.getAttribute("area")
+    nodes = [n for n in dom.getElementsByTagName("node") if n.getAttribute("area") == area]
+    sensors = sum([len(n.getElementsByTagName("sensor")) for n in nodes])
+    budget = SLOWDATA_BUDGET
+    alert_rate = 0.0
+    if reasoning_node.hasAttribute("slowdata_budget"):
+        budget = int(reasoning_node.getAttribute("slowdata_budget"))
+    if reasoning_node.hasAttribute("alert_rate"):
+        alert_rate = float(reasoning_node.getAttribute("alert_rate"))
+
+    # The slots are indexed on 8 bits, 255 meaning none
+    updates = min(max(sensors, 1), 254)
+    events = 16 # the events are referenced by 16 bits wide bit fields
+    reputation_bits = 1
+    while reputation_bits < 7 and (1 << reputation_bits) * 3 < sensors * 4:
+        reputation_bits += 1
+    # Every alert still weighing on the criticality (2 * max_intrusion_duration seconds) is kept
+    alerts = int(math.ceil(alert_rate * 2 * int(max_intrusion_duration) / 60))
+    # A whole number of bytes of the alert_used bit field, at most 248 slots
+    alerts = min((max(alerts, events * 3) + 7) / 8 * 8, 248)
+    alert_map = 1
+    while alert_map <= alerts:
+        alert_map *= 2
+    fixed = sum([size for name, size in reasoning_tables(updates, events, 0, alerts)])
+    states = min(events * updates, 254, (budget - fixed) / 7)
+    if states < events:
+        printError("WARNING: the reasoning tables of node " + node.getAttribute("id") + " exceed its .slowdata budget (" + str(budget) + " bytes)\n")
+        states = events
+
+    sizes = [("KNOWN_NODES_SIZE", max(len(nodes), 1)),
+             ("ALERT_HISTORY_SIZE", updates),
+             ("REPUTATION_TABLE_BITS", reputation_bits),
+             ("SUSPICIOUS_STATE_HISTORY_SIZE", events),
+             ("SENSOR_CONTRIBUTION_HISTORY_SIZE", states),
+             ("ALERT_TABLE_SIZE", alerts),
+             ("ALERT_MAP_SIZE", alert_map)]
+    return sizes, reasoning_tables(updates, events, states, alerts), budget
+
 def gen_reasoning_config(dom, node):
+    is_simulation = node.getAttribute("simulation") == "true"
+    # The SPIRIT driver of the boards only reports whether one of the beams is cut
+    if spirit_beam_count(node) > 1 and not is_simulation:
+        printError("Node " + node.getAttribute("id") + ": SPIRIT barriers with several beams are only simulated\n")
+        return -1
+    # Nothing reports the edges of the sensors of the boards yet
+    if sensors_event_driven(node) and not is_simulation:
+        printError("Node " + node.getAttribute("id") + ": event driven sensors are only simulated\n")
+        return -1
     reasoning = node.getElementsByTagName("reasoning")
     reasoning_node = node.getElementsByTagName("reasoning_node")
     log_analyse_period = "1440"
+    alert_coalescing_window = "0"
+    criticality_notify_delta = "1"
+    summary_period = "5"
     latencies = { "white" : "150", "green" : "100", "yellow" : "75", "orange" : "50", "red" : "25"}
     filename = "reasoning_config.h"
     if (len(reasoning) == 1):
@@ -405,6 +497,12 @@ def gen_reasoning_config(dom, node):
         if len(reasoning_node) == 1:
             is_reasoning = True
             log_analyse_period = reasoning_node[0].getAttribute("log_analyse_period")
+            if reasoning_node[0].hasAttribute("alert_coalescing_window"):
+                alert_coalescing_window = reasoning_node[0].getAttribute("alert_coalescing_window")
+            if reasoning_node[0].hasAttribute("criticality_notify_delta"):
+                criticality_notify_delta = reasoning_node[0].getAttribute("criticality_notify_delta")
+            if reasoning_node[0].hasAttribute("summary_period"):
+                summary_period = reasoning_node[0].getAttribute("summary_period")
         else:
             is_reasoning = False
     else:
@@ -426,14 +524,36 @@ def gen_reasoning_config(dom, node):
 
     reasoning_file.write("	#define SENSOR_HISTORY_SIZE 64\n")
     reasoning_file.write("	#define SIMULATION_ENTRY_MAX 50\n")
-    reasoning_file.write("	#define ALERT_HISTORY_SIZE 16\n")
-    reasoning_file.write("	#define SUSPICIOUS_STATE_HISTORY_SIZE 16\n")
-    reasoning_file.write("	#define SENSOR_CONTRIBUTION_HISTORY_SIZE 48\n")
+    if is_reasoning:
+        sizes, tables, budget = reasoning_table_sizes(dom, node, reasoning_node[0], max_intrusion_duration)
+        reasoning_file.write("	/* Table sizes, .slowdata budget of " + str(budget) + " bytes:\n")
+        for name, size in tables:
+            reasoning_file.write("	 *   %-20s %5u\n" % (name, size))
+        reasoning_file.write("	 */\n")
+        for name, size in sizes:
+            reasoning_file.write("	#define " + name + " " + str(size) + "\n")
+        print "Node " + node.getAttribute("id") + ": reasoning tables " + ", ".join([name + " " + str(size) for name, size in sizes]) + \
+            " (" + str(sum([size for name, size in tables])) + " of " + str(budget) + " bytes)"
+    else:
+        reasoning_file.write("	#define ALERT_HISTORY_SIZE 16\n")
+        reasoning_file.write("	#define SUSPICIOUS_STATE_HISTORY_SIZE 16\n")
+        reasoning_file.write("	#define SENSOR_CONTRIBUTION_HISTORY_SIZE 48\n")
     reasoning_file.write("	#define CRITICALITY_THRESHOLD 5\n")
+    reasoning_file.write("	#define SENSOR_SPIRIT_BEAM_COUNT " + str(spirit_beam_count(node)) + "\n")
+    reasoning_file.write("	/* PIR, seismic and switch sensors report their edges from interrupts */\n")
+    reasoning_file.write("	#define SENSOR_EVENT_DRIVEN " + ("1" if sensors_event_driven(node) else "0") + "\n")
+    reasoning_file.write("	/* The sensor histories hold runs of equal values instead of one bit per value */\n")
+    reasoning_file.write("	#define SENSOR_HISTORY_RUNS " + ("1" if sensors_history_runs(node) else "0") + "\n")
     
     reasoning_file.write("	#define MIN_INTRUSION_DURATION (" + min_intrusion_duration + "*1000)" + "\n")
     reasoning_file.write("	#define MAX_INTRUSION_DURATION (" + max_intrusion_duration + "*1000)" + "\n")
     reasoning_file.write("	#define HISTORY_ANALYZE_PERIOD (" + log_analyse_period + "*60*1000" + ")\n")
+    reasoning_file.write("	/* Alerts received within this window (ms) are evaluated together, 0 to disable */\n")
+    reasoning_file.write("	#define ALERT_COALESCING_WINDOW " + alert_coalescing_window + "\n")
+    reasoning_file.write("	/* The observers of criticality_lvl are notified when it moves by this delta */\n")
+    reasoning_file.write("	#define CRITICALITY_NOTIFY_DELTA " + criticality_notify_delta + "\n")
+    reasoning_file.write("	/* Period of the summaries published for the reasoning nodes monitoring the area, 0 disables them */\n")
+    reasoning_file.write("	#define AREA_SUMMARY_PERIOD (" + summary_period + "*1000)\n")
     reasoning_file.write("	/* 4 levels : green (1), yellow (2), orange (3) and red (4) */\n")
     reasoning_file.write("	#define LATENCY_MODE " + latencies[latency_mode] + "\n")
     reasoning_file.write("#endif\n")
@@ -548,6 +668,34 @@ def compile_node(dom, node, dest_dir, target):
     shutil.copyfile(make_output, dest_path)
     os.chmod(dest_path, os.stat(make_output)[0])
     os.chdir(cwd)
+    slowdata_report(dest_path)
+
+# Prints what each table takes in the .slowdata section of the firmware, from its symbol table
+def slowdata_report(firmware):
+    try:
+        sections = subprocess.check_output(["readelf", "-SW", firmware])
+        symbols = subprocess.check_output(["readelf", "-sW", firmware])
+    except (OSError, CalledProcessError):
+        printError("WARNING: readelf failed, no .slowdata report for " + firmware + "\n")
+        return
+    index = None
+    for line in sections.splitlines():
+        fields = line.replace("[", " ").replace("]", " ").split()
+        if len(fields) > 1 and fields[1] == ".slowdata":
+            index = fields[0]
+    if index is None:
+        return
+    tables = list()
+    for line in symbols.splitlines():
+        # Num: Value Size Type Bind Vis Ndx Name
+        fields = line.split()
+        if len(fields) == 8 and fields[3] == "OBJECT" and fields[6] == index:
+            tables.append((int(fields[2], 0), fields[7]))
+    tables.sort(reverse=True)
+    total = sum([size for size, name in tables])
+    print ".slowdata of " + os.path.basename(firmware) + ": " + str(total) + " of " + str(SLOWDATA_SIZE) + " bytes"
+    for size, name in tables:
+        print "    %-32s %6u" % (name, size)
 
 def build_node(dom, node, dest_dir):
     ret = gen_common_config(dom, node)
@@ -19,16 +19,28 @@
 #include "resourceshelper.h"
 #include <QtDeclarative/QtDeclarative>
 
+// The node may have forgotten the registration (reboot, lost response)
+#define OBSERVE_RENEW_INTERVAL 60000
+
 CoapEntity::CoapEntity(int nodeId, const QString &resourceName, QObject *parent):
     QObject(parent)
     , m_iface(new CoapInterface(nodeId, this))
     , m_timer(new QTimer(this))
     , m_resourceName(resourceName)
 {
-    m_timer->setInterval(2000);
+    m_observed = isObserved();
     m_timer->setSingleShot(false);
-    connect(m_timer, SIGNAL(timeout()), SLOT(updateModels()));
     connect(m_iface, SIGNAL(responsed(QByteArray&)), SLOT(handleResponse(QByteArray&)));
+    if (m_observed) {
+        // Once the model entries are added
+        QTimer::singleShot(0, this, SLOT(observe()));
+        m_timer->setInterval(OBSERVE_RENEW_INTERVAL);
+        connect(m_timer, SIGNAL(timeout()), SLOT(observe()));
+    }
+    else {
+        m_timer->setInterval(2000);
+        connect(m_timer, SIGNAL(timeout()), SLOT(updateModels()));
+    }
     m_timer->start();
 }
 
@@ -74,9 +86,22 @@ QString CoapEntity::resourceType() const
     return type;
 }
 
+bool CoapEntity::isObserved() const
+{
+    QSettings resourceMapper(RESOURCE_INI_FILENAME, QSettings::IniFormat);
+    bool observed;
+
+    resourceMapper.beginGroup(m_resourceName);
+    observed = resourceMapper.value("observe", false).toBool();
+    resourceMapper.endGroup();
+
+    return observed;
+}
+
 void CoapEntity::setRefreshInterval(int interval)
 {
-    m_timer->setInterval(interval);
+    if (!m_observed)
+        m_timer->setInterval(interval);
 }
 
 QString CoapEntity::resourceName() const
@@ -116,12 +141,15 @@ void CoapEntity::updateModels()
     if (m_entries.isEmpty() || m_resourceName.isEmpty())
         return;
 
-    if (resourceType() != "multipart") {
+    if (resourceType() != "multipart" && resourceType() != "history") {
         m_iface->callAsync(m_resourceName);
     }
     else {
         QString keys, values;
-        multipartResource(m_iface->nodeId(), m_resourceName, keys, values);
+        if (resourceType() == "history")
+            historyResource(m_iface->nodeId(), m_resourceName, keys, values);
+        else
+            multipartResource(m_iface->nodeId(), m_resourceName, keys, values);
 
         foreach (QObject *model, m_entries.keys()) {
             foreach(int entryIndex, m_entries[model]) {
@@ -134,3 +162,11 @@ void CoapEntity::updateModels()
         }
     }
 }
+
+void CoapEntity::observe()
+{
+    if (m_entries.isEmpty() || m_resourceName.isEmpty())
+        return;
+
+    m_iface->observe(m_resourceName);
+}
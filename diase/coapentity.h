@@ -30,6 +30,8 @@ class QTimer;
  * then it parses and extracts the response and saves it into the model(s) associated to the resource.
  * A CoapEntity always updates one resource for a given node, it can change one or many
  * model entries associated to the resource, for example because the same resource is present in differents views.
+ * The resources marked "observe" in the resource file are not polled, the entity registers as
+ * observer and the node notifies it of the changes.
  */
 class CoapEntity : public QObject
 {
@@ -70,7 +72,7 @@ public:
     void removeMonitoringModelEntry(QObject *model, int entryIndex);
 
     /*
-     * Change the update interval
+     * Change the update interval, unused for an observed resource
      *
      * @param interval the update periodicity in milliseconds
      */
@@ -79,14 +81,17 @@ public:
 private Q_SLOTS:
     void handleResponse(QByteArray & payload);
     void updateModels();
+    void observe();
 
 private:
     QString resourceType() const;
+    bool isObserved() const;
 
 private:
     CoapInterface *m_iface;
     QTimer *m_timer;
     QString m_resourceName;
+    bool m_observed;
     QMap<QObject *, QList<int> > m_entries;
 };
 
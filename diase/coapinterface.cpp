@@ -23,6 +23,8 @@
 
 #define COAP_DATA_MAX_SIZE 350
 #define COAP_PORT 61617
+#define COAP_BLOCK_SZX 2 // 64 bytes, the largest block fitting in a frame
+#define COAP_BLOCKWISE_ATTEMPTS 3
 
 CoapInterface::CoapInterface(int nodeId, QObject *parent) :
     QObject(parent)
@@ -39,7 +41,21 @@ void CoapInterface::getResponse(QByteArray &payload)
     Gateway::instance()->readDatagram(nodeid, pkt);
 
     m_code = (StatusCode)pkt.at(1);
-    payload = pkt.mid(4);
+    m_options.clear();
+
+    // Each option starts with 4 bits of delta to the previous option number and 4 bits of length
+    int count = pkt.at(0) & 0x0f, number = 0, pos = 4;
+    for (int i = 0; i < count && pos < pkt.size(); i++) {
+        int length = pkt.at(pos) & 0x0f;
+
+        number += (quint8)pkt.at(pos) >> 4;
+        pos++;
+        if (length == 15 && pos < pkt.size())
+            length += (quint8)pkt.at(pos++);
+        m_options.insert(number, pkt.mid(pos, length));
+        pos += length;
+    }
+    payload = pkt.mid(pos);
 }
 
 void CoapInterface::recvData(quint16 sourceNode, const QString &tagName)
@@ -58,11 +74,14 @@ void CoapInterface::recvData(quint16 sourceNode, const QString &tagName)
     emit responsed(payload);
 }
 
-void CoapInterface::callAsync(const QString &method, const QList<QVariant> &args)
+void CoapInterface::sendRequest(const QString &method, const QList<QVariant> &args, QMap<int, QByteArray> options)
 {
     QByteArray pkt;
+    int previous = 0;
+
+    options.insert(URI_PATH_OPTION, method.toAscii());
 
-    pkt += 0x51; // V = 1, T = Non-confirmable, and OC = 1
+    pkt += 0x50 + options.count(); // V = 1, T = Non-confirmable, and OC
     if (args.length() != 0)
         pkt += 0x02; // method POST
     else
@@ -70,14 +89,19 @@ void CoapInterface::callAsync(const QString &method, const QList<QVariant> &args
     pkt += (char)0x00; // transaction ID
     pkt += (char)0x00; // transaction ID
 
-    if (method.length() < 15) {
-        pkt += (0x90 + method.length());
-        pkt += method;
-    }
-    else {
-        pkt += 0x9f;
-        pkt += (method.length() - 15);
-        pkt += method;
+    // In increasing order, each one with the delta to the previous option number
+    foreach (int number, options.keys()) {
+        const QByteArray &value = options[number];
+
+        if (value.length() < 15) {
+            pkt += (((number - previous) << 4) + value.length());
+        }
+        else {
+            pkt += (((number - previous) << 4) + 0x0f);
+            pkt += (value.length() - 15);
+        }
+        pkt += value;
+        previous = number;
     }
 
     if(args.length() != 0 && args.at(0).canConvert(QVariant::String))
@@ -86,6 +110,79 @@ void CoapInterface::callAsync(const QString &method, const QList<QVariant> &args
     Gateway::instance()->writeDatagram(m_nodeId, pkt, method);
 }
 
+void CoapInterface::callAsync(const QString &method, const QList<QVariant> &args)
+{
+    sendRequest(method, args, QMap<int, QByteArray>());
+}
+
+QByteArray CoapInterface::callBlockwise(const QString &method, const QString &query)
+{
+    QMap<int, QByteArray> options;
+    QByteArray payload, etag;
+    quint32 num = 0;
+    int attempts = 0;
+
+    if (!query.isEmpty())
+        options.insert(URI_QUERY_OPTION, query.toAscii());
+
+    while (true) {
+        QByteArray block, part;
+        quint32 value = (num << 4) | COAP_BLOCK_SZX;
+        bool more = false;
+
+        // NUM, M and SZX on as few bytes as possible
+        do {
+            block.prepend((char)(value & 0xff));
+            value >>= 8;
+        } while (value != 0);
+
+        options.insert(BLOCK_OPTION, block);
+        sendRequest(method, QList<QVariant>(), options);
+        m_localLoop.exec();
+        getResponse(part);
+        if (m_code != OK_200)
+            return QByteArray();
+
+        if (num == 0) {
+            etag = option(ETAG_OPTION);
+        } else if (option(ETAG_OPTION) != etag) {
+            // Another snapshot was taken in between, the blocks do not match anymore
+            if (++attempts == COAP_BLOCKWISE_ATTEMPTS)
+                return QByteArray();
+            num = 0;
+            payload.clear();
+            continue;
+        }
+        payload += part;
+
+        // A node without block support answers with the whole resource
+        block = option(BLOCK_OPTION);
+        if (!block.isEmpty())
+            more = block.at(block.length() - 1) & 0x08;
+        if (!more)
+            break;
+        num++;
+    }
+    return payload;
+}
+
+void CoapInterface::observe(const QString &method)
+{
+    static quint16 tokens = 0;
+    QMap<int, QByteArray> options;
+
+    // The token tells the notifications of the interfaces apart, the same one is kept on renewal
+    if (m_token.isEmpty()) {
+        tokens++;
+        m_token.append((char)(tokens >> 8));
+        m_token.append((char)(tokens & 0xff));
+        Gateway::instance()->addObserver(m_nodeId, m_token, method);
+    }
+    options.insert(OBSERVE_OPTION, QByteArray());
+    options.insert(TOKEN_OPTION, m_token);
+    sendRequest(method, QList<QVariant>(), options);
+}
+
 QByteArray CoapInterface::call(const QString &method, const QList<QVariant> &args)
 {
     QByteArray payload;
@@ -114,3 +211,8 @@ CoapInterface::StatusCode CoapInterface::code() const
 {
     return m_code;
 }
+
+QByteArray CoapInterface::option(OptionNumber number) const
+{
+    return m_options.value(number);
+}
@@ -21,6 +21,7 @@
 #include <QtCore/QEventLoop>
 #include <QtCore/QVariant>
 #include <QtCore/QByteArray>
+#include <QtCore/QMap>
 
 class QUdpSocket;
 
@@ -44,6 +45,15 @@ public:
         GATEWAY_TIMEOUT_504 = 204
     } StatusCode;
 
+    typedef enum {
+        ETAG_OPTION = 4,
+        URI_PATH_OPTION = 9,
+        OBSERVE_OPTION = 10,
+        TOKEN_OPTION = 11,
+        BLOCK_OPTION = 13,
+        URI_QUERY_OPTION = 15
+    } OptionNumber;
+
     /*
      * Construct a CoapInterface for a node , described by nodeId
      * @param nodeId The remote node to contact through CoAP
@@ -71,12 +81,42 @@ public:
      */
     void callAsync(const QString &method, const QList<QVariant> &args = QList<QVariant>());
 
+    /*
+     * Call a GET method synchronously, its response being split in blocks (Block option)
+     *
+     * The blocks are requested one after the other and concatenated. When the ETag
+     * of a block differs from the one of the first block, the resource changed in
+     * between and the transfer starts over.
+     *
+     * @param method The resource to call remotely
+     * @param query The query of the request, "name=value"
+     * @return The whole response, empty on error or when the status is not OK_200
+     */
+    QByteArray callBlockwise(const QString &method, const QString &query = QString());
+
+    /*
+     * Register as observer of a resource (CoAP Observe)
+     *
+     * The signal responsed is emitted for the response to the registration, then
+     * for each notification sent by the node, until the node forgets the
+     * registration (reboot, table full). Calling it again renews the registration.
+     *
+     * @param method The resource to observe
+     */
+    void observe(const QString &method);
+
     /*
      * Get the status code returned by the last call
      * @return a status code corresponding the last request status
      */
     StatusCode code() const;
 
+    /*
+     * Get an option of the last response
+     * @return the value of the option @number, empty when it is absent
+     */
+    QByteArray option(OptionNumber number) const;
+
     /*
      * Change the node id attached to this CoapInterface
      */
@@ -102,10 +142,13 @@ private Q_SLOTS:
 
 private:
     void getResponse(QByteArray &payload);
+    void sendRequest(const QString &method, const QList<QVariant> &args, QMap<int, QByteArray> options);
 
 private:
     int m_nodeId;
     StatusCode m_code;
+    QMap<int, QByteArray> m_options;
+    QByteArray m_token;
     QEventLoop m_localLoop;
     QString m_currentMethod;
 };
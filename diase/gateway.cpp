@@ -23,9 +23,29 @@
 #define DIAFORUS_NET_PREFIX "1180::1063:9FF:FE30:"
 #define DIAFORUS_COAP_PORT 61617
 #define RESEND_TIMEOUT 5000
+#define TOKEN_OPTION 11
 
 Gateway *Gateway::s_instance = NULL;
 
+// The Token option of a CoAP datagram, empty when it has none
+static QByteArray datagramToken(const QByteArray &datagram)
+{
+    int count = datagram.isEmpty() ? 0 : datagram.at(0) & 0x0f, number = 0, pos = 4;
+
+    for (int i = 0; i < count && pos < datagram.size(); i++) {
+        int length = datagram.at(pos) & 0x0f;
+
+        number += (quint8)datagram.at(pos) >> 4;
+        pos++;
+        if (length == 15 && pos < datagram.size())
+            length += (quint8)datagram.at(pos++);
+        if (number == TOKEN_OPTION)
+            return datagram.mid(pos, length);
+        pos += length;
+    }
+    return QByteArray();
+}
+
 Gateway::Gateway(QObject *parent) :
     QObject(parent)
     , m_pendingSourceNode(0)
@@ -62,6 +82,7 @@ void Gateway::recvData()
     qint64 pendingDatagramSize;
     QHostAddress peerAddr;
     Pair currentRequest;
+    QString observer;
     char *data;
 
     m_pendingDatagram.clear();
@@ -73,6 +94,14 @@ void Gateway::recvData()
 
     m_pendingSourceNode = peerAddr.toString().replace(DIAFORUS_NET_PREFIX, "").replace("%0", "").toInt(0, 16);
 
+    // A notification, unless it is the response to the observe request itself
+    observer = m_observers.value(QString::number(m_pendingSourceNode) + ":" + datagramToken(m_pendingDatagram).toHex());
+    if (!observer.isEmpty() && (m_sendingQueue.isEmpty() ||
+                                m_sendingQueue.head().second != observer + ":" + QString::number(m_pendingSourceNode))) {
+        emit readyRead(m_pendingSourceNode, observer);
+        return;
+    }
+
     currentRequest = m_sendingQueue.dequeue();
     m_resendTimer->stop();
 
@@ -106,6 +135,11 @@ qint64 Gateway::readDatagram(quint16 &sourceNode, QByteArray &datagram)
     return m_pendingDatagram.size();
 }
 
+void Gateway::addObserver(quint16 sourceNode, const QByteArray &token, const QString &tagName)
+{
+    m_observers.insert(QString::number(sourceNode) + ":" + token.toHex(), tagName);
+}
+
 QAbstractSocket::SocketError Gateway::error() const
 {
     return m_socket->error();
@@ -21,6 +21,7 @@
 #include <QtCore/QByteArray>
 #include <QtCore/QQueue>
 #include <QtCore/QPair>
+#include <QtCore/QMap>
 #include <QtNetwork/QUdpSocket>
 
 class QTimer;
@@ -63,6 +64,17 @@ public:
      */
     qint64 readDatagram(quint16 &sourceNode, QByteArray &datagram);
 
+    /*
+     * Deliver the datagrams of node @sourceNode carrying the CoAP token @token as
+     * responses to @tagName, whether such a request is pending or not. This is
+     * how the notifications of an observed resource (CoAP Observe) are received.
+     *
+     * @param sourceNode The observed node identifier
+     * @param token The token of the observe request
+     * @param tagName The tagName of the observe request
+     */
+    void addObserver(quint16 sourceNode, const QByteArray &token, const QString &tagName);
+
     /*
      * Get the error of the last sent datagram
      */
@@ -88,6 +100,7 @@ private:
     QByteArray m_pendingDatagram;
     QUdpSocket *m_socket;
     QQueue<Pair> m_sendingQueue;
+    QMap<QString, QString> m_observers; // "node:token" to tagName
     QTimer *m_resendTimer;
 };
 
@@ -563,7 +563,10 @@ void MonitoringView::displayMultiPartResource(int nodeId, const QString &name, c
     QObject *gridView = NULL, *model = NULL;
     QString keys, values;
 
-    multipartResource(nodeId, name, keys, values);
+    if (resourceType(name) == "history")
+        historyResource(nodeId, name, keys, values);
+    else
+        multipartResource(nodeId, name, keys, values);
 
     if (drawing == "text" || drawing.startsWith("plugin::text")) {
         gridView = tileGridView();
@@ -598,7 +601,7 @@ void MonitoringView::coapResourceClicked(const QString &name)
     type = resourceType(name);
 
     // Simple Resources
-    if (type != "multipart") {
+    if (type != "multipart" && type != "history") {
         displayResource(node->nodeId(), name, drawing);
 
         if (drawing.contains(" ")) {
@@ -222,5 +222,123 @@ static inline void multipartResource(int nodeId, const QString &name, QString &k
 }
 
 
+struct HistoryEvent {
+    quint32 timestamp;
+    quint8 level;
+    QList<QPair<quint16, quint8> > states; // sensor id, contribution
+};
+
+struct HistoryCache {
+    HistoryCache() : generation(0), capacity(0) {}
+    quint16 generation; // 0 until a whole history is received
+    quint8 capacity;
+    QList<HistoryEvent> events;
+};
+
+/*
+ * Parse a snapshot written by reasoning_history_snapshot() into @cache. The
+ * events left unchanged since the generation of @cache are taken from it.
+ * @return false when the snapshot cannot be parsed or does not match @cache
+ */
+static inline bool parseHistory(const QByteArray &res, HistoryCache &cache)
+{
+    QDataStream in(res);
+    QList<HistoryEvent> events;
+    quint8 version, capacity, count, states, contribution, byte;
+    quint16 generation, sensorId;
+    quint32 timestamp, delta;
+    int i, j, shift;
+
+    if (res.size() < 9)
+        return false;
+    in >> version >> generation >> capacity >> count >> timestamp;
+    if (version != 1) {
+        qWarning() << "WARNING: unknown history version" << version;
+        return false;
+    }
+
+    for (i = 0; i < count; i++) {
+        HistoryEvent event;
+
+        // The timestamps are sent as the delta to the previous one, 7 bits per byte
+        delta = 0;
+        shift = 0;
+        do {
+            in >> byte;
+            delta |= (quint32)(byte & 0x7f) << shift;
+            shift += 7;
+        } while ((byte & 0x80) && in.status() == QDataStream::Ok);
+        timestamp += delta;
+        event.timestamp = timestamp;
+        in >> event.level >> states;
+
+        if (states == 0xff) { // unchanged
+            for (j = 0; j < cache.events.count(); j++)
+                if (cache.events.at(j).timestamp == event.timestamp && cache.events.at(j).level == event.level)
+                    break;
+            if (j == cache.events.count())
+                return false;
+            event.states = cache.events.at(j).states;
+        } else {
+            for (j = 0; j < states; j++) {
+                in >> sensorId >> contribution;
+                event.states << QPair<quint16, quint8>(sensorId, contribution);
+            }
+        }
+        if (in.status() != QDataStream::Ok)
+            return false;
+        events << event;
+    }
+
+    // The events absent from the snapshot have been evicted
+    cache.events = events;
+    cache.generation = generation;
+    cache.capacity = capacity;
+    return true;
+}
+
+/*
+ * The history of a reasoning node (type=history) comes in one blockwise
+ * transfer, only holding the events changed since the previous one. It is
+ * stored in the model of the former multipart history: the event timestamps
+ * as keys, the critical levels then the sensor id and contribution|event of
+ * each sensor state as values, the free event slots being 0.
+ */
+static inline void historyResource(int nodeId, const QString &name, QString &keysModel, QString &valuesModel)
+{
+    static QMap<int, HistoryCache> caches;
+    HistoryCache &cache = caches[nodeId];
+    CoapInterface iface(nodeId);
+    QStringList timestamps, levels, sensors;
+    QByteArray res;
+    int i;
+
+    if (cache.generation != 0)
+        res = iface.callBlockwise(name, "since=" + QString::number(cache.generation));
+    if (cache.generation == 0 || (iface.code() != CoapInterface::NOT_MODIFIED_304 && !parseHistory(res, cache))) {
+        // Start over from the whole history
+        cache = HistoryCache();
+        res = iface.callBlockwise(name);
+        if (!parseHistory(res, cache))
+            return;
+    }
+
+    for (i = 0; i < cache.events.count(); i++) {
+        const HistoryEvent &event = cache.events.at(i);
+        QPair<quint16, quint8> state;
+
+        timestamps << QString::number(event.timestamp);
+        levels << QString::number(event.level);
+        foreach (state, event.states)
+            sensors << QString::number(state.first) << QString::number(state.second << 4 | i);
+    }
+    for (; i < cache.capacity; i++) {
+        timestamps << "0";
+        levels << "0";
+    }
+    levels << sensors;
+    keysModel = timestamps.join(":");
+    valuesModel = levels.join(":");
+}
 
 #endif // RESOURCESHELPER_H